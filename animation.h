@@ -0,0 +1,173 @@
+#pragma once
+
+#include "viewstate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Zoom paths for animations: views at a few keyframes, interpolated for every frame
+ * in between.
+ */
+
+typedef struct Keyframe
+{
+    int frame;
+    ViewState view;
+    int iterations = 0; // 0 for automatic
+} Keyframe;
+
+/**
+ * @brief
+ * Read keyframes, one per line as "<frame> <re> <im> <zoom> [iterations]", where the zoom
+ * is given as for ViewState::fromString. Empty lines and lines starting with # are skipped.
+ *
+ * @return false (after printing a message) if the file is missing or malformed, or if frame
+ *         numbers do not increase
+ */
+bool readKeyframes(const std::string& path, std::vector<Keyframe>& keyframes)
+{
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path.c_str());
+        return false;
+    }
+    keyframes.clear();
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+        std::istringstream stream(line);
+        std::string first;
+        if (!(stream >> first) || first[0] == '#') continue;
+        Keyframe keyframe;
+        std::string re, im, zoom, iterations;
+        char* end;
+        keyframe.frame = (int) std::strtol(first.c_str(), &end, 10);
+        bool ok = *end == '\0' && (bool) (stream >> re >> im >> zoom)
+            && ViewState::fromString(re + " " + im + " " + zoom, keyframe.view);
+        if (ok && stream >> iterations) {
+            keyframe.iterations = iterations == "auto" ? 0 : atoi(iterations.c_str());
+            ok = iterations == "auto" || keyframe.iterations > 0;
+        }
+        if (ok && !keyframes.empty() && keyframe.frame <= keyframes.back().frame) {
+            fprintf(stderr, "%s:%d: frame numbers must increase\n", path.c_str(), lineNumber);
+            return false;
+        }
+        if (!ok) {
+            fprintf(stderr, "%s:%d: expected <frame> <re> <im> <zoom> [iterations]\n", path.c_str(), lineNumber);
+            return false;
+        }
+        keyframes.push_back(keyframe);
+    }
+    if (keyframes.empty()) {
+        fprintf(stderr, "No keyframes in %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ * The view at any frame of a zoom path through <keyframes>.
+ *
+ * The log2 zoom follows a monotone cubic through the keyframes (Fritsch-Butland tangents), so the
+ * zoom speed changes smoothly and never overshoots a keyframe. Between two keyframes a and b
+ * the center moves such that the screen offset of b's center, (a - b) * zoom_a at keyframe a,
+ * shrinks linearly with the zoom factor to 0 at keyframe b: b drifts into the middle of the
+ * screen while zooming in. The point that stays fixed on the screen is
+ * b + (b - a) * zoom_a / (zoom_b - zoom_a), beyond b as seen from a.
+ */
+class ZoomPath
+{
+public:
+    explicit ZoomPath(const std::vector<Keyframe>& keyframes) : keyframes(keyframes)
+    {
+        // tangents of log2 zoom over frame numbers
+        const size_t n = keyframes.size();
+        std::vector<double> secants(n > 1 ? n - 1 : 0);
+        for (size_t k = 0; k + 1 < n; ++k) {
+            secants[k] = (keyframes[k+1].view.logZoom - keyframes[k].view.logZoom)
+                / (keyframes[k+1].frame - keyframes[k].frame);
+        }
+        tangents.assign(n, 0.0);
+        for (size_t k = 0; k < n; ++k) {
+            if (k == 0 || k == n - 1) {
+                tangents[k] = n > 1 ? secants[k == 0 ? 0 : n - 2] : 0.0;
+            } else if (secants[k-1] * secants[k] > 0) {
+                // harmonic mean keeps the cubic monotone between the keyframes
+                tangents[k] = 2 / (1 / secants[k-1] + 1 / secants[k]);
+            }
+        }
+    }
+
+    int firstFrame() const { return keyframes.front().frame; }
+    int lastFrame() const { return keyframes.back().frame; }
+
+    /**
+     * @param iterations receives the iteration limit, interpolated geometrically over the
+     *                   zoom if both surrounding keyframes have one, otherwise 0 (automatic)
+     */
+    ViewState viewAt(int frame, int& iterations) const
+    {
+        frame = std::clamp(frame, firstFrame(), lastFrame());
+        size_t k = 0;
+        while (k + 2 < keyframes.size() && keyframes[k+1].frame <= frame) ++k;
+        if (keyframes.size() == 1 || frame == keyframes[k].frame) {
+            iterations = keyframes[k].iterations;
+            return keyframes[k].view;
+        }
+        if (frame == keyframes[k+1].frame) {
+            iterations = keyframes[k+1].iterations;
+            return keyframes[k+1].view;
+        }
+        const Keyframe& a = keyframes[k];
+        const Keyframe& b = keyframes[k+1];
+        const double length = b.frame - a.frame;
+        const double t = (frame - a.frame) / length;
+
+        // cubic Hermite segment of log2 zoom
+        const double t2 = t * t, t3 = t2 * t;
+        ViewState view;
+        view.logZoom = (2*t3 - 3*t2 + 1) * a.view.logZoom + (t3 - 2*t2 + t) * length * tangents[k]
+            + (-2*t3 + 3*t2) * b.view.logZoom + (t3 - t2) * length * tangents[k+1];
+
+        // center = b + (a - b) * s with s = (1/zoom - 1/zoom_b) / (1/zoom_a - 1/zoom_b), so the
+        // screen offset (b - center) * zoom = (b - a) * s * zoom of b is linear in the zoom;
+        // s is computed as mantissa * 2^exponent, since 1/zoom is beyond the range of a double
+        // for deep zooms
+        const double logA = a.view.logZoom, logB = b.view.logZoom;
+        double mantissa;
+        int exponent = 0;
+        // progress of the zoom from a to b, for the iteration limit
+        double progress = t;
+        if (std::fabs(logB - logA) < 1e-9) {
+            mantissa = 1 - t;
+        } else {
+            double e = logA - view.logZoom;
+            exponent = (int) std::floor(e);
+            mantissa = std::exp2(e - exponent) * std::expm1((view.logZoom - logB) * M_LN2)
+                / std::expm1((logA - logB) * M_LN2);
+            progress = (view.logZoom - logA) / (logB - logA);
+        }
+        int limbs = std::max({a.view.precisionLimbs(), b.view.precisionLimbs(), view.precisionLimbs()});
+        BigFixed s = BigFixed::fromDouble(mantissa, exponent, limbs);
+        view.real = b.view.real + (a.view.real - b.view.real) * s;
+        view.imaginary = b.view.imaginary + (a.view.imaginary - b.view.imaginary) * s;
+        view.updatePrecision();
+
+        iterations = 0;
+        if (a.iterations > 0 && b.iterations > 0) {
+            progress = std::clamp(progress, 0.0, 1.0);
+            iterations = (int) std::lround(std::pow((double) a.iterations, 1 - progress)
+                * std::pow((double) b.iterations, progress));
+        }
+        return view;
+    }
+
+private:
+    std::vector<Keyframe> keyframes;
+    std::vector<double> tangents;
+};
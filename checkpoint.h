@@ -0,0 +1,293 @@
+#pragma once
+
+#include "engine.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+#include <zlib.h>
+
+/*
+ * Checkpoint file of a render that is computed strip by strip, so that a render that
+ * is stopped can resume without computing the finished strips, the reference orbit or
+ * the iteration limit again.
+ *
+ * Layout (little-endian):
+ *   CheckpointHeader
+ *   description of the render settings, header.descriptionLength bytes
+ *   reference orbit: header.orbitLength doubles of real parts, then as many imaginary parts
+ *   strip records, each a CheckpointStrip followed by the zlib-compressed 8-bit RGB pixels
+ *   and, if rawSize > 0, the zlib-compressed iteration, smooth and distance rows
+ *
+ * Records are appended as strips finish; header.completedRows is only advanced after the
+ * records are on disk, so records beyond it (from an interrupted write) are ignored.
+ */
+
+const char checkpoint_magic[8] = {'M', 'B', 'C', 'K', 'P', 'T', '1', '\n'};
+
+typedef struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t descriptionLength;
+    int32_t nIterations;
+    uint32_t perturbation;
+    uint32_t completedRows; // rows 0 ... completedRows-1 are stored in the records
+    uint64_t orbitLength;
+} CheckpointHeader;
+
+typedef struct CheckpointStrip
+{
+    uint32_t firstRow;
+    uint32_t rows;
+    uint32_t rgbSize;
+    uint32_t rawSize;
+} CheckpointStrip;
+
+class Checkpoint
+{
+public:
+    ~Checkpoint()
+    {
+        if (file) fclose(file);
+    }
+
+    /**
+     * @brief
+     * Start a new checkpoint file, replacing any existing one.
+     *
+     * @param description settings that determine the pixels; a checkpoint only resumes the same render
+     */
+    bool create(const std::string& path, const std::string& description, int nIterations,
+        const ReferenceOrbit& reference, bool perturbation)
+    {
+        file = fopen(path.c_str(), "w+b");
+        if (!file) return false;
+        this->path = path;
+        header = CheckpointHeader();
+        memcpy(header.magic, checkpoint_magic, 8);
+        header.descriptionLength = (uint32_t) description.size();
+        header.nIterations = nIterations;
+        header.perturbation = perturbation ? 1 : 0;
+        header.orbitLength = perturbation ? reference.re.size() : 0;
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(description.data(), 1, description.size(), file);
+        if (perturbation) {
+            fwrite(reference.re.data(), sizeof(double), reference.re.size(), file);
+            fwrite(reference.im.data(), sizeof(double), reference.im.size(), file);
+        }
+        return commit();
+    }
+
+    /**
+     * @brief
+     * Open an existing checkpoint file for the render described by <description>.
+     * Its strips are then read with readStrip, before startAppending.
+     *
+     * @return false (after printing a message) if it is unreadable or belongs to another render
+     */
+    bool resume(const std::string& path, const std::string& description, int& nIterations,
+        ReferenceOrbit& reference, bool& perturbation)
+    {
+        file = fopen(path.c_str(), "r+b");
+        if (!file) {
+            fprintf(stderr, "Failed to open %s\n", path.c_str());
+            return false;
+        }
+        this->path = path;
+        fseek(file, 0, SEEK_END);
+        fileSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        std::string stored;
+        // lengths from the file are checked before anything is allocated for them
+        bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, checkpoint_magic, 8) == 0
+            && header.descriptionLength <= remaining();
+        if (ok) {
+            stored.resize(header.descriptionLength);
+            ok = fread(stored.data(), 1, stored.size(), file) == stored.size();
+        }
+        if (!ok) {
+            fprintf(stderr, "%s is not a valid checkpoint file\n", path.c_str());
+            return false;
+        }
+        if (stored != description) {
+            fprintf(stderr, "%s belongs to a different render:\n%s\n", path.c_str(), stored.c_str());
+            return false;
+        }
+        // the reference orbit is at most as long as the iteration limit needs, or as
+        // chooseIterationLimit may have needed for the automatic limit
+        const uint64_t maxOrbitLength = (uint64_t) std::max(header.nIterations, IterationLimitOptions().maxIterations)
+            + maxExtraIterations + 2;
+        if (header.nIterations < 1 || header.orbitLength > maxOrbitLength
+            || (header.perturbation != 0 && header.orbitLength < 2)) {
+            fprintf(stderr, "%s is not a valid checkpoint file\n", path.c_str());
+            return false;
+        }
+        if (header.orbitLength * 2 * sizeof(double) > remaining()) {
+            fprintf(stderr, "%s is truncated\n", path.c_str());
+            return false;
+        }
+        nIterations = header.nIterations;
+        perturbation = header.perturbation != 0;
+        reference.re.resize(header.orbitLength);
+        reference.im.resize(header.orbitLength);
+        if (fread(reference.re.data(), sizeof(double), header.orbitLength, file) != header.orbitLength
+            || fread(reference.im.data(), sizeof(double), header.orbitLength, file) != header.orbitLength) {
+            fprintf(stderr, "%s is truncated\n", path.c_str());
+            return false;
+        }
+        rowsRead = 0;
+        return true;
+    }
+
+    // rows stored in the checkpoint, counted from the top of the image
+    int completedRows() const { return header.completedRows; }
+
+    /**
+     * @brief
+     * Read the next stored strip after resume.
+     *
+     * @param height of the image, which the strip must lie in
+     * @param rgb receives rows x width 8-bit RGB pixels
+     * @param raw if not nullptr, receives the escape-time data of the rows
+     * @return false once all completed rows have been read, or if the file is damaged
+     */
+    bool readStrip(int width, int height, int& firstRow, int& rows, std::vector<uint8_t>& rgb, FrameBuffer* raw)
+    {
+        if (rowsRead >= (int) header.completedRows) return false;
+        CheckpointStrip strip;
+        if (fread(&strip, sizeof(strip), 1, file) != 1 || (int) strip.firstRow != rowsRead
+            || strip.rows == 0 || strip.rows > (uint32_t) (height - rowsRead)
+            || (uint64_t) strip.rgbSize + strip.rawSize > remaining()) {
+            return false;
+        }
+        firstRow = strip.firstRow;
+        rows = strip.rows;
+        const size_t pixels = (size_t) width * rows;
+        rgb.resize(3 * pixels);
+        if (!readCompressed(strip.rgbSize, rgb.data(), rgb.size())) return false;
+        if (raw) {
+            raw->width = width;
+            raw->height = rows;
+            raw->iterations.resize(pixels);
+            raw->smooth.resize(pixels);
+            raw->distance.resize(pixels);
+            std::vector<uint8_t> planes(12 * pixels);
+            if (strip.rawSize == 0 || !readCompressed(strip.rawSize, planes.data(), planes.size())) return false;
+            memcpy(raw->iterations.data(), planes.data(), 4 * pixels);
+            memcpy(raw->smooth.data(), planes.data() + 4 * pixels, 4 * pixels);
+            memcpy(raw->distance.data(), planes.data() + 8 * pixels, 4 * pixels);
+        } else if (strip.rawSize > 0) {
+            fseek(file, strip.rawSize, SEEK_CUR);
+        }
+        rowsRead += rows;
+        return true;
+    }
+
+    /**
+     * @brief
+     * After all stored strips have been read, drop the records of an interrupted write;
+     * new strips are appended from here.
+     */
+    bool startAppending()
+    {
+        if (rowsRead != (int) header.completedRows) return false;
+        long end = ftell(file);
+        return fseek(file, end, SEEK_SET) == 0 && ftruncate(fileno(file), end) == 0;
+    }
+
+    /**
+     * @brief
+     * Append the next strip. It only counts as completed after the next commit,
+     * which also reports a failure.
+     *
+     * @param rgb rows x width 8-bit RGB pixels
+     * @param raw if not nullptr, escape-time data of the strip, starting at row rawFirstRow of <raw>
+     */
+    bool appendStrip(int width, int firstRow, int rows, const std::vector<uint8_t>& rgb,
+        const FrameBuffer* raw = nullptr, int rawFirstRow = 0)
+    {
+        const size_t pixels = (size_t) width * rows;
+        std::vector<uint8_t> packedRGB, packedRaw;
+        if (!pack(rgb.data(), 3 * pixels, packedRGB)) return !(failed = true);
+        if (raw) {
+            std::vector<uint8_t> planes(12 * pixels);
+            const size_t offset = (size_t) rawFirstRow * width;
+            memcpy(planes.data(), raw->iterations.data() + offset, 4 * pixels);
+            memcpy(planes.data() + 4 * pixels, raw->smooth.data() + offset, 4 * pixels);
+            memcpy(planes.data() + 8 * pixels, raw->distance.data() + offset, 4 * pixels);
+            if (!pack(planes.data(), planes.size(), packedRaw)) return !(failed = true);
+        }
+        CheckpointStrip strip = {(uint32_t) firstRow, (uint32_t) rows, (uint32_t) packedRGB.size(),
+            (uint32_t) packedRaw.size()};
+        fwrite(&strip, sizeof(strip), 1, file);
+        fwrite(packedRGB.data(), 1, packedRGB.size(), file);
+        fwrite(packedRaw.data(), 1, packedRaw.size(), file);
+        pendingRows += rows;
+        failed = failed || ferror(file);
+        return !failed;
+    }
+
+    /**
+     * @brief
+     * Make the strips appended so far durable: write them to disk, then mark them completed.
+     */
+    bool commit()
+    {
+        if (failed || fflush(file) != 0 || fsync(fileno(file)) != 0) return false;
+        header.completedRows += pendingRows;
+        pendingRows = 0;
+        long end = ftell(file);
+        bool ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = fseek(file, end, SEEK_SET) == 0 && ok;
+        return fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+    }
+
+    /**
+     * @brief
+     * Delete the checkpoint file once the render has finished.
+     */
+    void remove()
+    {
+        if (file) fclose(file);
+        file = nullptr;
+        ::remove(path.c_str());
+    }
+
+private:
+    FILE* file = nullptr;
+    // size of the file when it was opened by resume
+    long fileSize = 0;
+    std::string path;
+    CheckpointHeader header;
+    int rowsRead = 0;
+    int pendingRows = 0;
+    bool failed = false;
+
+    static bool pack(const uint8_t* data, size_t size, std::vector<uint8_t>& packed)
+    {
+        uLongf packedSize = compressBound(size);
+        packed.resize(packedSize);
+        if (compress2(packed.data(), &packedSize, data, size, 1) != Z_OK) return false;
+        packed.resize(packedSize);
+        return true;
+    }
+
+    // bytes of the file after the current position, as far as they existed at resume
+    uint64_t remaining() const
+    {
+        long position = ftell(file);
+        return position >= 0 && position < fileSize ? (uint64_t) (fileSize - position) : 0;
+    }
+
+    bool readCompressed(uint32_t packedSize, uint8_t* out, size_t size)
+    {
+        std::vector<uint8_t> packed(packedSize);
+        if (fread(packed.data(), 1, packedSize, file) != packedSize) return false;
+        uLongf unpacked = size;
+        return uncompress(out, &unpacked, packed.data(), packedSize) == Z_OK && unpacked == size;
+    }
+};
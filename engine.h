@@ -0,0 +1,860 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+#include "viewstate.h"
+
+// for any complex number with magnitude larger than 2 the iteration will not converge
+const double convergence_radius_squared = 4.0;
+// the smooth iteration count and distance estimate need |z| well beyond 2
+const double smooth_radius_squared = 1e6;
+// at most this many iterations are spent after escaping to reach smooth_radius_squared
+const int maxExtraIterations = 8;
+
+// number of worker threads of the engine, 0 for one per hardware thread
+int engineThreads = 0;
+
+// if not nullptr, parallelFor adds the seconds each worker spent until no work was left
+// to (*workerBusySeconds)[worker], worker 0 being the calling thread; for measurements
+// of load balance, while only one parallelFor runs at a time
+std::vector<double>* workerBusySeconds = nullptr;
+
+/**
+ * @brief
+ * Number of worker threads parallelFor uses for <count> work items.
+ */
+int parallelWorkers(int count)
+{
+    int nThreads = engineThreads > 0 ? engineThreads : (int) std::thread::hardware_concurrency();
+    return std::max(1, std::min(nThreads, count));
+}
+
+/**
+ * @brief
+ * Like parallelFor, but calls body(k, worker) with the index of the worker thread,
+ * 0 ... parallelWorkers(count)-1, so that workers can accumulate into their own
+ * data without locks.
+ */
+template <typename Callable>
+void parallelForWorkers(int count, Callable body)
+{
+    const int nThreads = parallelWorkers(count);
+    std::atomic<int> next(0);
+    std::vector<double>* busySeconds = workerBusySeconds;
+    if (busySeconds && (int) busySeconds->size() < nThreads) {
+        busySeconds->resize(nThreads, 0.0);
+    }
+    auto worker = [&](int t) {
+        auto start = std::chrono::steady_clock::now();
+        for (int k = next++; k < count; k = next++) {
+            body(k, t);
+        }
+        if (busySeconds) {
+            (*busySeconds)[t] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; ++t) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+/**
+ * @brief
+ * Call body(k) for k = 0 ... count-1 on all worker threads. Work items are handed
+ * out one at a time, so items of very different cost (rows through the set vs.
+ * rows far outside) still balance.
+ */
+template <typename Callable>
+void parallelFor(int count, Callable body)
+{
+    parallelForWorkers(count, [&](int k, int) { body(k); });
+}
+
+// starting and ending values for real and imaginary part
+typedef struct SampleDimensions
+{
+    double xStart;
+    double xEnd;
+    double dx;
+    double yStart;
+    double yEnd;
+    double dy;
+    // xStart and yStart relative to the view center, as used by the perturbation kernel
+    double xStartOffset;
+    double yStartOffset;
+    // pixel (0, 0) of a frame rendered with these dimensions is pixel (firstColumn, firstRow)
+    // of the whole image; parts of an image then get exactly the same sample positions
+    int firstColumn = 0;
+    int firstRow = 0;
+} SampleDimensions;
+
+/**
+ * @brief
+ * Sample positions of a view on an xSteps x ySteps raster.
+ *
+ * @param view window center and zoom factor
+ * @param boundary at zoom factor 1 the window spans center +- boundary in both directions
+ */
+SampleDimensions createDimensions(const ViewState& view, double boundary, int xSteps, int ySteps)
+{
+    SampleDimensions s;
+    const double real_0 = view.real.toDouble();
+    const double imaginary_0 = view.imaginary.toDouble();
+    const double radius = boundary / view.zoomFactor();
+    s.xStart = real_0 - radius;
+    s.xEnd = real_0 + radius;
+    s.dx = (s.xEnd - s.xStart) / xSteps;
+
+    s.yStart = imaginary_0 - radius;
+    s.yEnd = imaginary_0 + radius;
+    s.dy = (s.yEnd - s.yStart) / ySteps;
+    s.xStartOffset = -radius;
+    s.yStartOffset = -radius;
+    return s;
+}
+
+/**
+ * @brief
+ * Like createDimensions, but with square pixels: the shorter side of the
+ * width x height image spans center +- boundary at zoom factor 1.
+ * Rows run from top to bottom as in image files, i.e. yStart is the largest
+ * imaginary value and dy is negative.
+ */
+SampleDimensions createImageDimensions(const ViewState& view, double boundary, int width, int height)
+{
+    SampleDimensions s;
+    const double spacing = 2 * boundary / view.zoomFactor() / std::min(width, height);
+    s.dx = spacing;
+    s.dy = -spacing;
+    s.xStartOffset = -0.5 * spacing * width;
+    s.yStartOffset = 0.5 * spacing * height;
+    s.xStart = view.real.toDouble() + s.xStartOffset;
+    s.xEnd = s.xStart + spacing * width;
+    s.yStart = view.imaginary.toDouble() + s.yStartOffset;
+    s.yEnd = s.yStart - spacing * height;
+    return s;
+}
+
+/**
+ * @brief
+ * For a complex number c = a + bi, count how many iterations it takes
+ * until the magnitude of z_n = z^2_n-1 + c is larger than 2.
+ *
+ * Optionally, the same pass also yields a continuous iteration count and an
+ * exterior distance estimate. For these the derivative dz_n/dc is carried along
+ * and escaped points are iterated a few more times, which does not change the
+ * returned integer count.
+ *
+ * @param a real value of input complex number
+ * @param b imaginary value of input complex number
+ * @param maxIterations after how many interations to stop
+ * @param smooth if given, receives the continuous iteration count divided by
+ *               maxIterations, clamped to [0, 1]; 1 for points that did not escape
+ * @param distance if given, receives the estimated distance of c to the Mandelbrot set
+ *                 in units of the complex plane; 0 for points that did not escape
+ */
+int iterateMandelbrot(double a, double b, int maxIterations, float* smooth = nullptr, float* distance = nullptr)
+{
+    double tmp_a = a;
+    double tmp_b = b;
+    if (smooth == nullptr && distance == nullptr) {
+        for (int i = 0; i < maxIterations; ++i) {
+            double original_a = tmp_a;
+            double original_b = tmp_b;
+            tmp_a = original_a*original_a - original_b*original_b + a;
+            tmp_b = 2*original_a*original_b + b;
+            if (tmp_a*tmp_a + tmp_b*tmp_b > convergence_radius_squared) {
+                return i;
+            }
+        }
+        return maxIterations;
+    }
+
+    // z_1 = c, so dz_1/dc = 1
+    double dz_a = 1.0;
+    double dz_b = 0.0;
+    auto step = [&]() {
+        double original_a = tmp_a;
+        double original_b = tmp_b;
+        double original_dz_a = dz_a;
+        dz_a = 2*(original_a*dz_a - original_b*dz_b) + 1;
+        dz_b = 2*(original_a*dz_b + original_b*original_dz_a);
+        tmp_a = original_a*original_a - original_b*original_b + a;
+        tmp_b = 2*original_a*original_b + b;
+    };
+    for (int i = 0; i < maxIterations; ++i) {
+        step();
+        if (tmp_a*tmp_a + tmp_b*tmp_b > convergence_radius_squared) {
+            int n = i;
+            while (n < i + maxExtraIterations && tmp_a*tmp_a + tmp_b*tmp_b < smooth_radius_squared) {
+                step();
+                ++n;
+            }
+            double abs_z = std::sqrt(tmp_a*tmp_a + tmp_b*tmp_b);
+            double log_z = std::log(abs_z);
+            if (smooth) {
+                double mu = n + 1 - std::log2(log_z);
+                *smooth = (float) std::clamp(mu / maxIterations, 0.0, 1.0);
+            }
+            if (distance) {
+                *distance = (float) (0.5 * abs_z * log_z / std::hypot(dz_a, dz_b));
+            }
+            return i;
+        }
+    }
+    if (smooth) *smooth = 1.0f;
+    if (distance) *distance = 0.0f;
+    return maxIterations;
+}
+
+/**
+ * @brief
+ * Orbit Z_0 = 0, Z_1 = C, Z_n+1 = Z_n^2 + C of the view center C, computed at the
+ * full precision of the view and rounded to doubles. Pixels are then iterated as
+ * small deviations from it, see iteratePerturbed.
+ */
+typedef struct ReferenceOrbit
+{
+    std::vector<double> re;
+    std::vector<double> im;
+    // last element at full precision, where extendReferenceOrbit continues
+    BigFixed za;
+    BigFixed zb;
+} ReferenceOrbit;
+
+// beyond this zoom factor, double precision pixel coordinates no longer resolve the image
+const double perturbation_zoom = 1e10;
+
+/**
+ * @brief
+ * Continue the reference orbit of the view center, as computed by computeReferenceOrbit
+ * for the same <view>, until it escapes or has <length> elements.
+ */
+void extendReferenceOrbit(const ViewState& view, ReferenceOrbit& orbit, int length)
+{
+    const size_t start = orbit.re.size();
+    if ((int) start >= length
+        || orbit.re.back()*orbit.re.back() + orbit.im.back()*orbit.im.back() > convergence_radius_squared) {
+        return;
+    }
+    TraceSpan span("reference orbit");
+    orbit.re.reserve(length);
+    orbit.im.reserve(length);
+    BigFixed& za = orbit.za;
+    BigFixed& zb = orbit.zb;
+    for (int n = (int) start; n < length; ++n) {
+        BigFixed original_a = za;
+        za = original_a*original_a - zb*zb + view.real;
+        zb = original_a*zb;
+        zb = zb + zb + view.imaginary;
+        double a = za.toDouble();
+        double b = zb.toDouble();
+        orbit.re.push_back(a);
+        orbit.im.push_back(b);
+        if (a*a + b*b > convergence_radius_squared) break;
+    }
+    span.setIterations(orbit.re.size() - start);
+}
+
+/**
+ * @brief
+ * Compute the reference orbit of the view center until it escapes or has
+ * <length> elements.
+ */
+ReferenceOrbit computeReferenceOrbit(const ViewState& view, int length)
+{
+    ReferenceOrbit orbit;
+    orbit.za = BigFixed(view.precisionLimbs());
+    orbit.zb = BigFixed(view.precisionLimbs());
+    orbit.re.push_back(0.0);
+    orbit.im.push_back(0.0);
+    extendReferenceOrbit(view, orbit, length);
+    return orbit;
+}
+
+/**
+ * @brief
+ * Same as iterateMandelbrot for c = C + dc, where C is the reference point of <orbit>.
+ * Only the deviation dz_n = z_n - Z_n is iterated in double precision:
+ * dz_n+1 = (2 Z_n + dz_n) dz_n + dc.
+ * Whenever |z_n| < |dz_n| or the reference orbit ends, the deviation is rebased
+ * onto the start of the orbit (dz = z, n = 0), which avoids the glitches of
+ * classic perturbation without needing more reference points.
+ *
+ * @param orbit reference orbit with at least two elements
+ * @param dca real offset of c from the reference point
+ * @param dcb imaginary offset of c from the reference point
+ */
+int iteratePerturbed(const ReferenceOrbit& orbit, double dca, double dcb, int maxIterations,
+    float* smooth = nullptr, float* distance = nullptr)
+{
+    const size_t last = orbit.re.size() - 1;
+    const bool details = smooth != nullptr || distance != nullptr;
+    // z_1 = c = Z_1 + dc
+    size_t m = 1;
+    double dza = dca;
+    double dzb = dcb;
+    double za = orbit.re[1] + dza;
+    double zb = orbit.im[1] + dzb;
+    double dz_a = 1.0;
+    double dz_b = 0.0;
+    auto rebase = [&]() {
+        if (m == last || za*za + zb*zb < dza*dza + dzb*dzb) {
+            dza = za;
+            dzb = zb;
+            m = 0;
+        }
+    };
+    auto step = [&]() {
+        if (details) {
+            double original_dz_a = dz_a;
+            dz_a = 2*(za*dz_a - zb*dz_b) + 1;
+            dz_b = 2*(za*dz_b + zb*original_dz_a);
+        }
+        double ta = 2*orbit.re[m] + dza;
+        double tb = 2*orbit.im[m] + dzb;
+        double original_dza = dza;
+        dza = ta*dza - tb*dzb + dca;
+        dzb = ta*dzb + tb*original_dza + dcb;
+        ++m;
+        za = orbit.re[m] + dza;
+        zb = orbit.im[m] + dzb;
+    };
+    rebase();
+
+    for (int i = 0; i < maxIterations; ++i) {
+        step();
+        if (za*za + zb*zb > convergence_radius_squared) {
+            if (details) {
+                int n = i;
+                while (n < i + maxExtraIterations && za*za + zb*zb < smooth_radius_squared) {
+                    rebase();
+                    step();
+                    ++n;
+                }
+                double abs_z = std::sqrt(za*za + zb*zb);
+                double log_z = std::log(abs_z);
+                if (smooth) {
+                    double mu = n + 1 - std::log2(log_z);
+                    *smooth = (float) std::clamp(mu / maxIterations, 0.0, 1.0);
+                }
+                if (distance) {
+                    *distance = (float) (0.5 * abs_z * log_z / std::hypot(dz_a, dz_b));
+                }
+            }
+            return i;
+        }
+        rebase();
+    }
+    if (smooth) *smooth = 1.0f;
+    if (distance) *distance = 0.0f;
+    return maxIterations;
+}
+
+/**
+ * @brief
+ * Whether pixel coordinates of <view> need the perturbation kernel.
+ */
+bool needsPerturbation(const ViewState& view)
+{
+    return view.zoomFactor() > perturbation_zoom;
+}
+
+/**
+ * @brief
+ * Iterate the sample at (fractional) pixel position (i, j) of <dimensions>,
+ * with the perturbation kernel if a reference orbit of the view center is given.
+ */
+int iteratePixel(const SampleDimensions& dimensions, const ReferenceOrbit* reference, double i, double j,
+    int maxIterations, float* smooth = nullptr, float* distance = nullptr)
+{
+    i += dimensions.firstColumn;
+    j += dimensions.firstRow;
+    if (reference) {
+        return iteratePerturbed(*reference, dimensions.xStartOffset + i*dimensions.dx,
+            dimensions.yStartOffset + j*dimensions.dy, maxIterations, smooth, distance);
+    }
+    return iterateMandelbrot(dimensions.xStart + i*dimensions.dx, dimensions.yStart + j*dimensions.dy,
+        maxIterations, smooth, distance);
+}
+
+// escape-time data of every pixel of a frame, row by row
+typedef struct FrameBuffer
+{
+    int width = 0;
+    int height = 0;
+    std::vector<int> iterations;
+    // continuous iteration count divided by the iteration limit (only filled with details)
+    std::vector<float> smooth;
+    // exterior distance estimate in pixels (only filled with details)
+    std::vector<float> distance;
+} FrameBuffer;
+
+// how many pixels escaped at each iteration
+typedef struct EscapeHistogram
+{
+    std::vector<uint64_t> counts; // counts[n]: pixels that escaped at iteration n
+    uint64_t interior = 0;        // pixels that did not escape within the iteration limit
+
+    uint64_t exterior() const
+    {
+        uint64_t sum = 0;
+        for (uint64_t c : counts) sum += c;
+        return sum;
+    }
+
+    void add(const EscapeHistogram& other)
+    {
+        if (counts.size() < other.counts.size()) counts.resize(other.counts.size(), 0);
+        for (size_t n = 0; n < other.counts.size(); ++n) {
+            counts[n] += other.counts[n];
+        }
+        interior += other.interior;
+    }
+
+    /**
+     * @brief
+     * Smallest iteration by which at least <fraction> of the exterior pixels had escaped,
+     * e.g. 0.999 for an iteration limit that resolves all but 0.1% of them.
+     */
+    int percentile(double fraction) const
+    {
+        const double target = fraction * exterior();
+        uint64_t sum = 0;
+        for (size_t n = 0; n < counts.size(); ++n) {
+            sum += counts[n];
+            if (sum > 0 && sum >= target) return (int) n;
+        }
+        return (int) counts.size();
+    }
+} EscapeHistogram;
+
+/**
+ * @brief
+ * Add <count> escape iterations to <histogram>.
+ */
+void addEscapes(const int* iterations, size_t count, int maxIterations, EscapeHistogram& histogram)
+{
+    for (size_t k = 0; k < count; ++k) {
+        int n = iterations[k];
+        if (n < maxIterations) {
+            // grown as needed, so that merging costs no more than the deepest escape
+            if ((size_t) n >= histogram.counts.size()) histogram.counts.resize(n + 1, 0);
+            ++histogram.counts[n];
+        } else {
+            ++histogram.interior;
+        }
+    }
+}
+
+/**
+ * @brief
+ * Add the escape iterations of all pixels of <frame> to <histogram>, with one
+ * histogram per worker as in renderFrame.
+ */
+void countEscapes(const FrameBuffer& frame, int maxIterations, EscapeHistogram& histogram)
+{
+    std::vector<EscapeHistogram> workerHistograms(parallelWorkers(frame.height));
+    parallelForWorkers(frame.height, [&](int j, int worker) {
+        addEscapes(frame.iterations.data() + (size_t) j*frame.width, frame.width, maxIterations,
+            workerHistograms[worker]);
+    });
+    for (const EscapeHistogram& h : workerHistograms) {
+        histogram.add(h);
+    }
+}
+
+/**
+ * @brief
+ * Run the escape-time iteration for every sample of <dimensions>.
+ *
+ * @param frame resized to width x height
+ * @param details also fill the smooth and distance channels
+ * @param reference reference orbit of the view center for deep zooms, see needsPerturbation
+ * @param histogram if not nullptr, the escape iterations of the frame are added to it; every
+ *                  worker counts into its own histogram, which are merged at the end
+ */
+void renderFrame(const SampleDimensions& dimensions, int width, int height, int maxIterations,
+    FrameBuffer& frame, bool details, const ReferenceOrbit* reference = nullptr,
+    EscapeHistogram* histogram = nullptr)
+{
+    frame.width = width;
+    frame.height = height;
+    frame.iterations.resize((size_t) width * height);
+    frame.smooth.resize(details ? frame.iterations.size() : 0);
+    frame.distance.resize(details ? frame.iterations.size() : 0);
+
+    // rows are split into blocks, so that very wide, short frames still keep all threads busy
+    const int blockWidth = 1024;
+    const int blocksPerRow = (width + blockWidth - 1) / blockWidth;
+    std::vector<EscapeHistogram> workerHistograms(histogram ? parallelWorkers(height * blocksPerRow) : 0);
+    parallelForWorkers(height * blocksPerRow, [&](int block, int worker) {
+        int j = block / blocksPerRow;
+        int iStart = (block % blocksPerRow) * blockWidth;
+        int iEnd = std::min(width, iStart + blockWidth);
+        TraceSpan span("block", iStart + dimensions.firstColumn, j + dimensions.firstRow);
+        for (int i = iStart; i < iEnd; i++) {
+            size_t index = (size_t) j*width + i;
+            if (details) {
+                frame.iterations[index] = iteratePixel(dimensions, reference, i, j, maxIterations,
+                    &frame.smooth[index], &frame.distance[index]);
+                frame.distance[index] /= dimensions.dx;
+            } else {
+                frame.iterations[index] = iteratePixel(dimensions, reference, i, j, maxIterations);
+            }
+        }
+        if (histogram) {
+            addEscapes(&frame.iterations[(size_t) j*width + iStart], iEnd - iStart, maxIterations,
+                workerHistograms[worker]);
+        }
+        if (span.active()) {
+            int64_t spent = 0;
+            for (int i = iStart; i < iEnd; i++) {
+                spent += std::min(frame.iterations[(size_t) j*width + i] + 1, maxIterations);
+            }
+            span.setIterations(spent);
+        }
+    });
+    for (const EscapeHistogram& h : workerHistograms) {
+        histogram->add(h);
+    }
+}
+
+/**
+ * @brief
+ * Take a probe of chooseIterationLimit at offset (dca, dcb) from the reference point
+ * from iteration <start> to <end> by perturbation, exactly as iteratePerturbed would.
+ * The state (z, the deviation dz from <orbit> and the position m in it) is kept
+ * between calls; at <start> 0 it is initialized.
+ *
+ * @param escapedAt set to the iteration at which the probe escaped
+ * @param inside set if z returns to its value at <start> within the square root of
+ *        <cycleEpsilonSquared>, i.e. the orbit has reached an attracting cycle
+ */
+void continuePerturbedProbe(const ReferenceOrbit& orbit, double dca, double dcb, int start, int end,
+    double& za, double& zb, double& dza, double& dzb, size_t& m, int& escapedAt, char& inside,
+    double cycleEpsilonSquared)
+{
+    const size_t last = orbit.re.size() - 1;
+    if (start == 0) {
+        // z_1 = c = Z_1 + dc
+        m = 1;
+        dza = dca;
+        dzb = dcb;
+        za = orbit.re[1] + dza;
+        zb = orbit.im[1] + dzb;
+        if (m == last || za*za + zb*zb < dza*dza + dzb*dzb) {
+            dza = za;
+            dzb = zb;
+            m = 0;
+        }
+    }
+    const double cycle_a = za;
+    const double cycle_b = zb;
+    for (int i = start; i < end; ++i) {
+        double ta = 2*orbit.re[m] + dza;
+        double tb = 2*orbit.im[m] + dzb;
+        double original_dza = dza;
+        dza = ta*dza - tb*dzb + dca;
+        dzb = ta*dzb + tb*original_dza + dcb;
+        ++m;
+        za = orbit.re[m] + dza;
+        zb = orbit.im[m] + dzb;
+        if (za*za + zb*zb > convergence_radius_squared) {
+            escapedAt = i;
+            return;
+        }
+        double da = za - cycle_a;
+        double db = zb - cycle_b;
+        if (da*da + db*db < cycleEpsilonSquared) {
+            inside = 1;
+            return;
+        }
+        if (m == last || za*za + zb*zb < dza*dza + dzb*dzb) {
+            dza = za;
+            dzb = zb;
+            m = 0;
+        }
+    }
+}
+
+typedef struct IterationLimitOptions
+{
+    // the view is probed on a gridSize x gridSize grid
+    int gridSize = 48;
+    int minIterations = 50;
+    int maxIterations = 200000;
+    // share of all probes that may still escape beyond the chosen limit
+    double tolerance = 0.002;
+    // safety factor on top of the iteration count that resolves the probes
+    double headroom = 1.25;
+    // once probes were found inside, rounds in a row without escapes after which the
+    // remaining probes are taken to be inside as well
+    int interiorRounds = 3;
+} IterationLimitOptions;
+
+// upper bound of chooseIterationLimit in the explorers, which choose a limit on every view change
+const int interactive_max_iterations = 20000;
+
+/**
+ * @brief
+ * Choose an iteration limit just high enough to resolve the view.
+ *
+ * A sparse grid of probes over the view is iterated in rounds of doubling length
+ * (continuing where the previous round stopped). As long as a noticeable share of
+ * the probes still escapes during a round, the fraction of unescaped probes is still
+ * dropping and the limit is too low. Once it levels off, the remaining probes are
+ * taken to be inside the set and the limit is set so that all but <tolerance>
+ * of the probes that did escape are resolved. Rounds continue until at least one
+ * probe escaped, so deep views whose points all need many iterations are handled.
+ * A probe whose orbit returns to where it was at the start of a round (the orbit
+ * has reached an attracting cycle) is inside the set and not iterated further.
+ * Rounds stop when all unescaped probes are inside, or when probes were found
+ * inside and none escaped for <interiorRounds> rounds, so views of the interior
+ * take a few rounds instead of running every probe up to maxIterations.
+ * With a reference orbit, probes are iterated by perturbation as in iteratePerturbed.
+ *
+ * @param dimensions the region of the view; only the start and end values (and offsets) are used
+ * @param reference reference orbit of the view center for deep zooms, see needsPerturbation
+ * @param prepareRound called with the length of every round before it starts, e.g. to
+ *        extend <reference> to that length (plus two) with extendReferenceOrbit
+ */
+template <typename Callable>
+int chooseIterationLimit(const SampleDimensions& dimensions, const IterationLimitOptions& options,
+    const ReferenceOrbit* reference, Callable prepareRound)
+{
+    const int n = options.gridSize;
+    const size_t nProbes = (size_t) n * n;
+    // probe positions relative to xStart / yStart
+    std::vector<double> pa(nProbes), pb(nProbes);
+    for (size_t k = 0; k < nProbes; ++k) {
+        pa[k] = ((k % n) + 0.5) / n * (dimensions.xEnd - dimensions.xStart);
+        pb[k] = ((k / n) + 0.5) / n * (dimensions.yEnd - dimensions.yStart);
+    }
+    std::vector<double> za(nProbes), zb(nProbes);
+    for (size_t k = 0; k < nProbes; ++k) {
+        za[k] = dimensions.xStart + pa[k];
+        zb[k] = dimensions.yStart + pb[k];
+    }
+    // with a reference orbit, the deviation from it and the position in it
+    std::vector<double> dza(reference ? nProbes : 0), dzb(reference ? nProbes : 0);
+    std::vector<size_t> orbitIndex(reference ? nProbes : 0);
+    std::vector<int> escapedAt(nProbes, -1);
+    std::vector<char> inside(nProbes, 0);
+    // distance at which an orbit counts as returned: far below the probe spacing and double rounding of z
+    const double cycleEpsilon = std::min(1e-12, 1e-6 * std::abs(dimensions.xEnd - dimensions.xStart) / n);
+    const double cycleEpsilonSquared = cycleEpsilon * cycleEpsilon;
+
+    int done = 0;
+    int limit = options.minIterations;
+    size_t unescaped = nProbes;
+    int quietRounds = 0;
+    while (true) {
+        // continue all unescaped probes from <done> to <limit> iterations
+        prepareRound(limit);
+        TraceSpan span("iteration limit round");
+        span.setIterations(limit);
+        parallelFor(n, [&](int row) {
+            for (size_t k = (size_t) row * n; k < (size_t) (row + 1) * n; ++k) {
+                if (escapedAt[k] >= 0 || inside[k]) continue;
+                if (reference) {
+                    continuePerturbedProbe(*reference, dimensions.xStartOffset + pa[k], dimensions.yStartOffset + pb[k],
+                        done, limit, za[k], zb[k], dza[k], dzb[k], orbitIndex[k], escapedAt[k], inside[k],
+                        cycleEpsilonSquared);
+                    continue;
+                }
+                double tmp_a = za[k];
+                double tmp_b = zb[k];
+                const double a = dimensions.xStart + pa[k];
+                const double b = dimensions.yStart + pb[k];
+                // cycles up to the length of this round are found (Brent's method)
+                const double cycle_a = tmp_a;
+                const double cycle_b = tmp_b;
+                for (int i = done; i < limit; ++i) {
+                    double original_a = tmp_a;
+                    double original_b = tmp_b;
+                    tmp_a = original_a*original_a - original_b*original_b + a;
+                    tmp_b = 2*original_a*original_b + b;
+                    if (tmp_a*tmp_a + tmp_b*tmp_b > convergence_radius_squared) {
+                        escapedAt[k] = i;
+                        break;
+                    }
+                    double da = tmp_a - cycle_a;
+                    double db = tmp_b - cycle_b;
+                    if (da*da + db*db < cycleEpsilonSquared) {
+                        inside[k] = 1;
+                        break;
+                    }
+                }
+                za[k] = tmp_a;
+                zb[k] = tmp_b;
+            }
+        });
+        size_t stillUnescaped = std::count(escapedAt.begin(), escapedAt.end(), -1);
+        size_t escapedThisRound = unescaped - stillUnescaped;
+        bool anyEscaped = stillUnescaped < nProbes;
+        size_t nInside = std::count(inside.begin(), inside.end(), 1);
+        unescaped = stillUnescaped;
+        done = limit;
+        quietRounds = escapedThisRound == 0 ? quietRounds + 1 : 0;
+        if ((anyEscaped && escapedThisRound <= options.tolerance * nProbes) || limit >= options.maxIterations
+            || nInside == unescaped || (nInside > 0 && quietRounds >= options.interiorRounds)) {
+            break;
+        }
+        limit = (int) std::min<long>(2L * limit, options.maxIterations);
+    }
+
+    std::vector<int> escapes;
+    for (int e : escapedAt) {
+        if (e >= 0) escapes.push_back(e);
+    }
+    if (escapes.empty()) {
+        return options.minIterations;
+    }
+    size_t unresolved = std::min(escapes.size() - 1, (size_t) (options.tolerance * nProbes));
+    std::nth_element(escapes.begin(), escapes.end() - 1 - unresolved, escapes.end());
+    double needed = escapes[escapes.size() - 1 - unresolved] * options.headroom;
+    return (int) std::clamp<double>(std::ceil(needed), options.minIterations, options.maxIterations);
+}
+
+/**
+ * @brief
+ * chooseIterationLimit with a <reference> orbit (if any) that is long enough for all rounds.
+ */
+int chooseIterationLimit(const SampleDimensions& dimensions, const IterationLimitOptions& options = IterationLimitOptions(),
+    const ReferenceOrbit* reference = nullptr)
+{
+    return chooseIterationLimit(dimensions, options, reference, [](int) {});
+}
+
+typedef struct SupersampleOptions
+{
+    // samples per supersampled pixel, rounded down to a square number
+    int maxSamples = 16;
+    // supersample pixels whose distance estimate is below this many pixels
+    float threshold = 1.0f;
+    // seed of the jitter pattern; the same seed gives the same image
+    uint32_t seed = 1;
+} SupersampleOptions;
+
+/**
+ * @brief
+ * Small deterministic hash, so that every pixel gets its own jitter pattern
+ * independent of which thread processes it.
+ */
+uint32_t hashPixel(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/**
+ * @brief
+ * Whether pixel (i, j) lies near the boundary of the set: it escaped at a distance
+ * below the threshold, or it did not escape but one of its neighbours did.
+ */
+bool isBoundaryPixel(const FrameBuffer& frame, int i, int j, int maxIterations, float threshold)
+{
+    size_t index = (size_t) j*frame.width + i;
+    if (frame.iterations[index] < maxIterations) {
+        return frame.distance[index] < threshold;
+    }
+    const int neighbours[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    for (const auto& n : neighbours) {
+        int ii = i + n[0];
+        int jj = j + n[1];
+        if (ii < 0 || jj < 0 || ii >= frame.width || jj >= frame.height) continue;
+        if (frame.iterations[(size_t) jj*frame.width + ii] < maxIterations) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief
+ * Anti-alias a colored frame by supersampling only the pixels near the boundary
+ * of the set, as found with the distance estimate. Every such pixel is replaced by
+ * the average color of a jittered grid of samples over its footprint.
+ *
+ * @param frame result of renderFrame with details
+ * @param colorize colorize(iterations, smooth, r, g, b), the same coloring as used for <rgb>
+ * @param rgb colors of all pixels, 3 floats per pixel, updated in place
+ * @param reference reference orbit of the view center for deep zooms, see needsPerturbation
+ * @param firstRow, endRow only supersample rows firstRow ... endRow-1 (endRow -1: to the last row);
+ *                 the other rows only serve as neighbours
+ * @return number of supersampled pixels
+ */
+template <typename Callable>
+size_t supersampleFrame(const SampleDimensions& dimensions, int maxIterations, const FrameBuffer& frame,
+    const SupersampleOptions& options, Callable colorize, std::vector<float>& rgb,
+    const ReferenceOrbit* reference = nullptr, int firstRow = 0, int endRow = -1)
+{
+    if (endRow < 0) endRow = frame.height;
+    std::vector<uint32_t> boundary;
+    for (int j = firstRow; j < endRow; ++j) {
+        for (int i = 0; i < frame.width; ++i) {
+            if (isBoundaryPixel(frame, i, j, maxIterations, options.threshold)) {
+                boundary.push_back((uint32_t) j*frame.width + i);
+            }
+        }
+    }
+
+    const int gridSize = std::max(1, (int) std::sqrt((double) options.maxSamples));
+    const int chunkSize = 64;
+    const int nChunks = (int) ((boundary.size() + chunkSize - 1) / chunkSize);
+    parallelFor(nChunks, [&](int chunk) {
+        size_t end = std::min(boundary.size(), (size_t) (chunk + 1) * chunkSize);
+        uint32_t first = boundary[(size_t) chunk * chunkSize];
+        TraceSpan span("supersample", first % frame.width + dimensions.firstColumn,
+            first / frame.width + dimensions.firstRow);
+        int64_t spent = 0;
+        for (size_t k = (size_t) chunk * chunkSize; k < end; ++k) {
+            uint32_t index = boundary[k];
+            int i = index % frame.width;
+            int j = index / frame.width;
+            // seeded by the position in the whole image, so that the pattern does
+            // not depend on how the image is split into frames
+            uint32_t column = i + dimensions.firstColumn;
+            uint32_t row = j + dimensions.firstRow;
+            uint32_t random = hashPixel(column ^ hashPixel(row ^ options.seed * 0x9e3779b9u));
+            float sum[3] = {0.0f, 0.0f, 0.0f};
+            for (int sy = 0; sy < gridSize; ++sy) {
+                for (int sx = 0; sx < gridSize; ++sx) {
+                    random = hashPixel(random);
+                    float jitterX = (random & 0xffff) / 65536.0f;
+                    float jitterY = (random >> 16) / 65536.0f;
+                    double x = i - 0.5 + (sx + jitterX) / gridSize;
+                    double y = j - 0.5 + (sy + jitterY) / gridSize;
+                    float smooth;
+                    int iterations = iteratePixel(dimensions, reference, x, y, maxIterations, &smooth);
+                    spent += std::min(iterations + 1, maxIterations);
+                    float rr, gg, bb;
+                    colorize(iterations, smooth, rr, gg, bb);
+                    sum[0] += rr;
+                    sum[1] += gg;
+                    sum[2] += bb;
+                }
+            }
+            for (int c = 0; c < 3; ++c) {
+                rgb[3*(size_t) index + c] = sum[c] / (gridSize * gridSize);
+            }
+        }
+        span.setIterations(spent);
+    });
+    return boundary.size();
+}
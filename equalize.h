@@ -0,0 +1,92 @@
+#pragma once
+
+#include "engine.h"
+#include "rainbow.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Histogram-equalized coloring: instead of value / max_N, an escape iteration is
+ * mapped to the share of exterior pixels that escaped by then, so that each part of
+ * the palette covers about as many pixels. The result is an ordinary color table
+ * indexed by iteration count (as from createRGBVectors), so coloring a pixel stays a
+ * table lookup, and a new palette only needs a new table, not a new histogram.
+ */
+
+// entries of the palette table the equalized colors are interpolated from
+const int equalize_palette_size = 4096;
+
+/**
+ * @brief
+ * Share of the exterior pixels of <histogram> that escaped at or before each iteration,
+ * computed with a parallel prefix sum: every worker sums a chunk of the histogram,
+ * the chunk sums are scanned, and every worker then fills in the running sums of its chunk.
+ *
+ * @param levels resized to nIterations, values in [0, 1]
+ */
+void equalizedLevels(const EscapeHistogram& histogram, int nIterations, std::vector<float>& levels)
+{
+    levels.assign(nIterations, 0.0f);
+    const size_t size = std::min<size_t>(histogram.counts.size(), nIterations);
+    const size_t chunkSize = 1 << 14;
+    const int nChunks = (int) ((size + chunkSize - 1) / chunkSize);
+    std::vector<uint64_t> offsets(nChunks + 1, 0);
+    parallelFor(nChunks, [&](int chunk) {
+        uint64_t sum = 0;
+        for (size_t n = chunk * chunkSize; n < std::min(size, (chunk + 1) * chunkSize); ++n) {
+            sum += histogram.counts[n];
+        }
+        offsets[chunk + 1] = sum;
+    });
+    for (int chunk = 0; chunk < nChunks; ++chunk) {
+        offsets[chunk + 1] += offsets[chunk];
+    }
+    const double total = (double) offsets[nChunks];
+    if (total == 0) return;
+    parallelFor(nChunks, [&](int chunk) {
+        uint64_t running = offsets[chunk];
+        for (size_t n = chunk * chunkSize; n < std::min(size, (chunk + 1) * chunkSize); ++n) {
+            running += histogram.counts[n];
+            levels[n] = (float) (running / total);
+        }
+    });
+    // no pixel escaped beyond the histogram
+    std::fill(levels.begin() + size, levels.end(), 1.0f);
+}
+
+/**
+ * @brief
+ * Like createRGBVectors, but equalized by <histogram>: iteration n gets the color of
+ * its level from equalizedLevels. Pixels that did not escape keep the palette's color
+ * for max_N.
+ *
+ * @param r, g, b resized to nIterations+1 entries
+ */
+template <typename Callable>
+void createEqualizedRGBVectors(const EscapeHistogram& histogram, int nIterations,
+    std::vector<float>& r,
+    std::vector<float>& g,
+    std::vector<float>& b,
+    Callable colorFunction)
+{
+    std::vector<float> pr(equalize_palette_size+1), pg(equalize_palette_size+1), pb(equalize_palette_size+1);
+    createRGBVectors(equalize_palette_size, pr, pg, pb, colorFunction);
+    std::vector<float> levels;
+    equalizedLevels(histogram, nIterations, levels);
+
+    r.resize(nIterations+1);
+    g.resize(nIterations+1);
+    b.resize(nIterations+1);
+    // the exterior spans the palette up to the entry before the interior color
+    const float scale = (float) (equalize_palette_size - 1) / equalize_palette_size;
+    const int chunkSize = 1 << 14;
+    parallelFor((nIterations + chunkSize - 1) / chunkSize, [&](int chunk) {
+        for (int n = chunk * chunkSize; n < std::min(nIterations, (chunk + 1) * chunkSize); ++n) {
+            interpolateRGB(levels[n] * scale, pr, pg, pb, r[n], g[n], b[n]);
+        }
+    });
+    r[nIterations] = pr[equalize_palette_size];
+    g[nIterations] = pg[equalize_palette_size];
+    b[nIterations] = pb[equalize_palette_size];
+}
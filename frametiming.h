@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+/*
+ * Where the time of each frame of the explorers goes. A frame is split into stages by
+ * calling mark() at the end of each stage; everything runs on the main thread, so there
+ * are no locks, only a steady_clock read per stage.
+ */
+
+enum FrameStage
+{
+    stage_compute,   // iteration limit, escape-time iteration and supersampling
+    stage_colorize,  // palette lookup and vertex data
+    stage_upload,    // copying vertex data to the GPU
+    stage_swap,      // drawing and waiting for the buffer swap
+    stage_count
+};
+
+const char* const frame_stage_names[stage_count] = {"compute", "colorize", "upload", "swap"};
+
+// overlay colors of the stages
+const float frame_stage_colors[stage_count][3] = {
+    {0.90f, 0.30f, 0.20f},
+    {0.95f, 0.75f, 0.20f},
+    {0.30f, 0.70f, 0.95f},
+    {0.50f, 0.85f, 0.40f},
+};
+
+typedef struct FrameTimes
+{
+    double seconds[stage_count] = {};
+
+    double total() const
+    {
+        double sum = 0;
+        for (double s : seconds) sum += s;
+        return sum;
+    }
+} FrameTimes;
+
+class FrameTimer
+{
+public:
+    // frames kept for the overlay
+    static const int history_length = 120;
+
+    ~FrameTimer()
+    {
+        if (log) fclose(log);
+    }
+
+    /**
+     * @brief
+     * Also append every frame to a CSV file.
+     */
+    bool openLog(const std::string& path)
+    {
+        log = fopen(path.c_str(), "w");
+        if (!log) return false;
+        fprintf(log, "frame");
+        for (const char* name : frame_stage_names) {
+            fprintf(log, ",%s_ms", name);
+        }
+        fprintf(log, ",total_ms,iterations\n");
+        return true;
+    }
+
+    /**
+     * @brief
+     * Add the time since the previous mark (or the start of the frame) to <stage>.
+     */
+    void mark(FrameStage stage)
+    {
+        auto now = std::chrono::steady_clock::now();
+        current.seconds[stage] += std::chrono::duration<double>(now - last).count();
+        last = now;
+    }
+
+    /**
+     * @brief
+     * Finish the current frame and start the next one.
+     *
+     * @param iterations iteration limit of the frame, for the log
+     */
+    void endFrame(int iterations)
+    {
+        history[frames % history_length] = current;
+        if (log) {
+            fprintf(log, "%ld", frames);
+            for (double s : current.seconds) {
+                fprintf(log, ",%.3f", 1e3 * s);
+            }
+            fprintf(log, ",%.3f,%d\n", 1e3 * current.total(), iterations);
+        }
+        ++frames;
+        current = FrameTimes();
+        last = std::chrono::steady_clock::now();
+    }
+
+    long frameCount() const { return frames; }
+
+    // frame <age> frames ago, 0 being the last finished frame
+    const FrameTimes& recent(int age) const
+    {
+        return history[(frames - 1 - age + history_length) % history_length];
+    }
+
+    /**
+     * @brief
+     * Average of the last <count> finished frames.
+     */
+    FrameTimes average(int count = history_length) const
+    {
+        FrameTimes sum;
+        count = (int) std::min<long>(count, std::min<long>(frames, history_length));
+        for (int age = 0; age < count; ++age) {
+            for (int s = 0; s < stage_count; ++s) {
+                sum.seconds[s] += recent(age).seconds[s] / count;
+            }
+        }
+        return sum;
+    }
+
+    /**
+     * @brief
+     * "compute 1.2 ms, colorize ..., 58.9 fps" for the last <count> frames.
+     */
+    std::string summary(int count = 30) const
+    {
+        FrameTimes times = average(count);
+        std::string text;
+        char part[64];
+        for (int s = 0; s < stage_count; ++s) {
+            snprintf(part, sizeof(part), "%s%s %.1f ms", s ? ", " : "", frame_stage_names[s], 1e3 * times.seconds[s]);
+            text += part;
+        }
+        snprintf(part, sizeof(part), ", %.1f fps", times.total() > 0 ? 1 / times.total() : 0.0);
+        return text + part;
+    }
+
+private:
+    FrameTimes history[history_length];
+    FrameTimes current;
+    long frames = 0;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    FILE* log = nullptr;
+};
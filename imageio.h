@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+/**
+ * @brief
+ * Convert colors with 3 floats in [0, 1] per pixel to 8-bit RGB.
+ */
+void floatToRGB8(const float* rgb, size_t nPixels, uint8_t* out)
+{
+    for (size_t k = 0; k < 3 * nPixels; ++k) {
+        out[k] = (uint8_t) (std::clamp(rgb[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+/**
+ * @brief
+ * PNG encoder (8-bit RGB) that takes the image a few rows at a time, so images
+ * of any height can be written with memory for only the rows passed in.
+ * Compressed data is flushed to the file in IDAT chunks as it is produced.
+ */
+class PngWriter
+{
+public:
+    ~PngWriter()
+    {
+        if (file) {
+            deflateEnd(&stream);
+            fclose(file);
+        }
+    }
+
+    /**
+     * @param level zlib compression level; 1 is much faster than the default and
+     *              barely larger for fractal images
+     * @return false if the file could not be created
+     */
+    bool open(const std::string& path, int width, int height, int level = 1)
+    {
+        file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        this->width = width;
+        this->height = height;
+        rowsWritten = 0;
+        stream = z_stream();
+        if (deflateInit(&stream, level) != Z_OK) return false;
+        buffer.resize(1 << 16);
+
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        fwrite(signature, 1, 8, file);
+        uint8_t header[13];
+        putBigEndian(header, width);
+        putBigEndian(header + 4, height);
+        header[8] = 8;  // bit depth
+        header[9] = 2;  // color type RGB
+        header[10] = 0; // compression
+        header[11] = 0; // filter method
+        header[12] = 0; // no interlace
+        writeChunk("IHDR", header, 13);
+        return !ferror(file);
+    }
+
+    /**
+     * @brief
+     * Append <rows> rows of 8-bit RGB pixels.
+     */
+    bool writeRows(const uint8_t* rgb, int rows)
+    {
+        std::vector<uint8_t> line(1 + 3 * (size_t) width);
+        for (int j = 0; j < rows; ++j) {
+            line[0] = 0; // filter type None
+            std::copy(rgb + 3 * (size_t) width * j, rgb + 3 * (size_t) width * (j + 1), line.begin() + 1);
+            if (!compress(line.data(), line.size(), Z_NO_FLUSH)) return false;
+        }
+        rowsWritten += rows;
+        return true;
+    }
+
+    /**
+     * @brief
+     * Finish the image. All rows must have been written.
+     */
+    bool close()
+    {
+        bool ok = rowsWritten == height && compress(nullptr, 0, Z_FINISH);
+        writeChunk("IEND", nullptr, 0);
+        deflateEnd(&stream);
+        ok = !ferror(file) && ok;
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    FILE* file = nullptr;
+    z_stream stream;
+    std::vector<uint8_t> buffer;
+    int width = 0;
+    int height = 0;
+    int rowsWritten = 0;
+
+    static void putBigEndian(uint8_t* out, uint32_t value)
+    {
+        out[0] = value >> 24;
+        out[1] = value >> 16;
+        out[2] = value >> 8;
+        out[3] = value;
+    }
+
+    void writeChunk(const char* type, const uint8_t* data, uint32_t length)
+    {
+        uint8_t bytes[4];
+        putBigEndian(bytes, length);
+        fwrite(bytes, 1, 4, file);
+        fwrite(type, 1, 4, file);
+        if (length > 0) fwrite(data, 1, length, file);
+        uLong crc = crc32(0, (const Bytef*) type, 4);
+        if (length > 0) crc = crc32(crc, data, length);
+        putBigEndian(bytes, (uint32_t) crc);
+        fwrite(bytes, 1, 4, file);
+    }
+
+    bool compress(const uint8_t* data, size_t size, int flush)
+    {
+        stream.next_in = (Bytef*) data;
+        stream.avail_in = (uInt) size;
+        int status;
+        do {
+            stream.next_out = buffer.data();
+            stream.avail_out = (uInt) buffer.size();
+            status = deflate(&stream, flush);
+            if (status == Z_STREAM_ERROR) return false;
+            uint32_t produced = (uint32_t) (buffer.size() - stream.avail_out);
+            if (produced > 0) writeChunk("IDAT", buffer.data(), produced);
+        } while (stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+        return true;
+    }
+};
+
+/**
+ * @brief
+ * Streaming writer for PNG or, for paths ending in .ppm or "-" (stdout), binary PPM.
+ * Rows are passed in from top to bottom, a few at a time.
+ */
+class ImageWriter
+{
+public:
+    ~ImageWriter()
+    {
+        // writers that are not closed (after a failed writeRows) still flush what they have
+        if (file && file != stdout) {
+            fclose(file);
+        } else if (file) {
+            fflush(file);
+        }
+    }
+
+    bool open(const std::string& path, int width, int height)
+    {
+        this->width = width;
+        ppm = path == "-" || (path.size() >= 4 && path.compare(path.size() - 4, 4, ".ppm") == 0);
+        if (!ppm) {
+            return png.open(path, width, height);
+        }
+        file = path == "-" ? stdout : fopen(path.c_str(), "wb");
+        if (!file) return false;
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        return !ferror(file);
+    }
+
+    bool writeRows(const uint8_t* rgb, int rows)
+    {
+        if (!ppm) {
+            return png.writeRows(rgb, rows);
+        }
+        size_t count = (size_t) width * rows;
+        return fwrite(rgb, 3, count, file) == count;
+    }
+
+    bool close()
+    {
+        if (!ppm) {
+            return png.close();
+        }
+        bool ok = !ferror(file);
+        if (file != stdout) {
+            ok = fclose(file) == 0 && ok;
+        } else {
+            ok = fflush(file) == 0 && ok;
+        }
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    bool ppm = false;
+    PngWriter png;
+    FILE* file = nullptr;
+    int width = 0;
+};
+
+/**
+ * @brief
+ * Write a whole image of 8-bit RGB pixels, see ImageWriter for the formats.
+ */
+bool writeImage(const std::string& path, int width, int height, const uint8_t* rgb)
+{
+    ImageWriter writer;
+    return writer.open(path, width, height) && writer.writeRows(rgb, height) && writer.close();
+}
@@ -0,0 +1,385 @@
+#pragma once
+
+#include "engine.h"
+#include "viewstate.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/*
+ * Raw iteration file: the escape-time data of a render, so that it can be recolored,
+ * analysed or cropped without computing it again.
+ *
+ * Layout (little-endian):
+ *   IterationFileHeader
+ *   view as printed by ViewState::toString, padded with spaces to header.viewLength,
+ *   a multiple of 8 bytes
+ *   tile index: for every tile, row by row, uint64 offset and uint64 size of its data
+ *   tile data
+ *
+ * The image is split into tileSize x tileSize tiles; tiles at the right and bottom
+ * edges are padded to the full size. A tile holds one plane per stored channel, in
+ * the order iterations (int32), smooth (float), distance (float), each tileSize^2
+ * values row by row. Tiles are stored as they are, or compressed with zlib each.
+ * Uncompressed tiles start at multiples of 64 bytes and are read straight from the
+ * memory-mapped file.
+ */
+
+const char iteration_file_magic[8] = {'M', 'B', 'I', 'T', 'E', 'R', '1', '\n'};
+
+// bits of IterationFileHeader::channels
+const uint32_t channel_iterations = 1;
+const uint32_t channel_smooth = 2;
+const uint32_t channel_distance = 4;
+
+typedef struct IterationFileHeader
+{
+    char magic[8];
+    uint32_t width;
+    uint32_t height;
+    uint32_t tileSize;
+    uint32_t channels;
+    uint32_t compressed; // 1 if tiles are zlib streams
+    int32_t maxIterations;
+    uint32_t precisionLimbs; // fractional limbs of the view center, see ViewState::precisionLimbs
+    uint32_t viewLength;
+} IterationFileHeader;
+
+size_t iterationFileTileCount(const IterationFileHeader& header)
+{
+    size_t columns = ((size_t) header.width + header.tileSize - 1) / header.tileSize;
+    size_t rows = ((size_t) header.height + header.tileSize - 1) / header.tileSize;
+    return columns * rows;
+}
+
+int iterationFileChannelCount(uint32_t channels)
+{
+    return (channels & channel_iterations ? 1 : 0) + (channels & channel_smooth ? 1 : 0)
+        + (channels & channel_distance ? 1 : 0);
+}
+
+/**
+ * @brief
+ * Writes a raw iteration file from rows of escape-time data passed in from top to
+ * bottom, a few at a time. Only one row of tiles is held in memory.
+ */
+class IterationFileWriter
+{
+public:
+    ~IterationFileWriter()
+    {
+        if (file) fclose(file);
+    }
+
+    /**
+     * @param channels channel_iterations, optionally with channel_smooth and channel_distance
+     * @param compress store the tiles zlib-compressed instead of memory-mappable as they are
+     * @return false if the file could not be created
+     */
+    bool open(const std::string& path, int width, int height, uint32_t channels, int maxIterations,
+        const ViewState& view, bool compress = true, int tileSize = 256)
+    {
+        file = fopen(path.c_str(), "wb");
+        if (!file) return false;
+        std::string viewText = view.toString();
+        viewText.resize((viewText.size() + 7) / 8 * 8, ' ');
+        header = IterationFileHeader();
+        memcpy(header.magic, iteration_file_magic, 8);
+        header.width = width;
+        header.height = height;
+        header.tileSize = tileSize;
+        header.channels = channels | channel_iterations;
+        header.compressed = compress ? 1 : 0;
+        header.maxIterations = maxIterations;
+        header.precisionLimbs = view.precisionLimbs();
+        header.viewLength = (uint32_t) viewText.size();
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(viewText.data(), 1, viewText.size(), file);
+        // the index is filled in by close()
+        indexOffset = sizeof(header) + viewText.size();
+        index.assign(2 * iterationFileTileCount(header), 0);
+        fwrite(index.data(), sizeof(uint64_t), index.size(), file);
+        offset = indexOffset + index.size() * sizeof(uint64_t);
+        tilesWritten = 0;
+        rowsBuffered = 0;
+        rowsWritten = 0;
+        failed = false;
+        const size_t columns = (width + tileSize - 1) / tileSize;
+        rows.iterations.assign(columns * tileSize * tileSize, 0);
+        rows.smooth.assign(header.channels & channel_smooth ? rows.iterations.size() : 0, 0.0f);
+        rows.distance.assign(header.channels & channel_distance ? rows.iterations.size() : 0, 0.0f);
+        return !ferror(file);
+    }
+
+    /**
+     * @brief
+     * Append rows firstRow ... firstRow+count-1 of <frame>, which must be as wide as the image
+     * and have the smooth and distance channels if they are stored.
+     * A failure is also reported by close().
+     */
+    bool writeRows(const FrameBuffer& frame, int firstRow, int count)
+    {
+        const size_t stride = rows.iterations.size() / header.tileSize;
+        for (int j = firstRow; j < firstRow + count; ++j) {
+            size_t source = (size_t) j * frame.width;
+            size_t target = rowsBuffered * stride;
+            std::copy_n(frame.iterations.begin() + source, header.width, rows.iterations.begin() + target);
+            if (!rows.smooth.empty()) {
+                std::copy_n(frame.smooth.begin() + source, header.width, rows.smooth.begin() + target);
+            }
+            if (!rows.distance.empty()) {
+                std::copy_n(frame.distance.begin() + source, header.width, rows.distance.begin() + target);
+            }
+            ++rowsBuffered;
+            ++rowsWritten;
+            if (rowsBuffered == (int) header.tileSize || rowsWritten == (int) header.height) {
+                if (!flushTiles()) {
+                    failed = true;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief
+     * Finish the file. All rows must have been written.
+     */
+    bool close()
+    {
+        bool ok = !failed && rowsWritten == (int) header.height && tilesWritten == index.size() / 2;
+        ok = fseek(file, (long) indexOffset, SEEK_SET) == 0 && ok;
+        fwrite(index.data(), sizeof(uint64_t), index.size(), file);
+        ok = !ferror(file) && ok;
+        ok = fclose(file) == 0 && ok;
+        file = nullptr;
+        return ok;
+    }
+
+private:
+    FILE* file = nullptr;
+    IterationFileHeader header;
+    std::vector<uint64_t> index;
+    size_t indexOffset = 0;
+    size_t offset = 0;
+    size_t tilesWritten = 0;
+    int rowsBuffered = 0;
+    int rowsWritten = 0;
+    bool failed = false;
+    FrameBuffer rows; // one row of tiles, padded to whole tiles
+
+    // write the buffered row of tiles
+    bool flushTiles()
+    {
+        const int tileSize = header.tileSize;
+        const size_t stride = rows.iterations.size() / tileSize;
+        const size_t tilePixels = (size_t) tileSize * tileSize;
+        std::vector<uint8_t> tile(iterationFileChannelCount(header.channels) * tilePixels * 4);
+        std::vector<uint8_t> packed;
+        for (size_t x = 0; x < stride; x += tileSize) {
+            uint8_t* plane = tile.data();
+            auto copyPlane = [&](const auto& channel) {
+                for (int j = 0; j < tileSize; ++j) {
+                    memcpy(plane + (size_t) j * tileSize * 4, channel.data() + j * stride + x, (size_t) tileSize * 4);
+                }
+                plane += tilePixels * 4;
+            };
+            copyPlane(rows.iterations);
+            if (!rows.smooth.empty()) copyPlane(rows.smooth);
+            if (!rows.distance.empty()) copyPlane(rows.distance);
+
+            const uint8_t* data = tile.data();
+            uLongf size = tile.size();
+            if (header.compressed) {
+                packed.resize(compressBound(tile.size()));
+                size = packed.size();
+                if (compress2(packed.data(), &size, tile.data(), tile.size(), 1) != Z_OK) return false;
+                data = packed.data();
+            } else {
+                // align, so that the planes can be used in place when the file is mapped
+                static const uint8_t zeros[64] = {};
+                size_t padding = (64 - offset % 64) % 64;
+                fwrite(zeros, 1, padding, file);
+                offset += padding;
+            }
+            if (fwrite(data, 1, size, file) != size) return false;
+            index[2 * tilesWritten] = offset;
+            index[2 * tilesWritten + 1] = size;
+            offset += size;
+            ++tilesWritten;
+        }
+        // padding of the last row of tiles repeats stale rows, which is harmless
+        rowsBuffered = 0;
+        return true;
+    }
+};
+
+// the channels of one tile, each tileSize x tileSize values row by row; nullptr if not stored
+typedef struct IterationTile
+{
+    const int32_t* iterations = nullptr;
+    const float* smooth = nullptr;
+    const float* distance = nullptr;
+} IterationTile;
+
+/**
+ * @brief
+ * Read access to a raw iteration file through a read-only memory mapping.
+ */
+class IterationFile
+{
+public:
+    IterationFile() = default;
+    IterationFile(const IterationFile&) = delete;
+    IterationFile& operator=(const IterationFile&) = delete;
+
+    ~IterationFile()
+    {
+        if (data) munmap((void*) data, size);
+    }
+
+    /**
+     * @return false (after printing a message) if the file is missing or not a valid raw iteration file
+     */
+    bool open(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open %s\n", path.c_str());
+            return false;
+        }
+        struct stat status;
+        bool ok = fstat(fd, &status) == 0 && (size_t) status.st_size >= sizeof(IterationFileHeader);
+        if (ok) {
+            size = status.st_size;
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            ok = mapping != MAP_FAILED;
+            data = ok ? (const uint8_t*) mapping : nullptr;
+        }
+        ::close(fd);
+        ok = ok && validate();
+        if (!ok) {
+            fprintf(stderr, "%s is not a valid raw iteration file\n", path.c_str());
+        }
+        return ok;
+    }
+
+    const IterationFileHeader& header() const { return *(const IterationFileHeader*) data; }
+    int width() const { return header().width; }
+    int height() const { return header().height; }
+    int tileSize() const { return header().tileSize; }
+    int maxIterations() const { return header().maxIterations; }
+    uint32_t channels() const { return header().channels; }
+    int tileColumns() const { return (width() + tileSize() - 1) / tileSize(); }
+    int tileRows() const { return (height() + tileSize() - 1) / tileSize(); }
+    const ViewState& view() const { return viewState; }
+
+    /**
+     * @brief
+     * Channels of tile (x, y). Uncompressed tiles point into the mapping; compressed
+     * tiles are unpacked into <scratch>, so each thread needs its own.
+     */
+    bool readTile(int x, int y, IterationTile& tile, std::vector<uint8_t>& scratch) const
+    {
+        const uint64_t* index = tileIndex() + 2 * ((size_t) y * tileColumns() + x);
+        const uint8_t* planes = data + index[0];
+        const size_t tilePixels = (size_t) tileSize() * tileSize();
+        const size_t tileBytes = iterationFileChannelCount(channels()) * tilePixels * 4;
+        if (header().compressed) {
+            scratch.resize(tileBytes);
+            uLongf unpacked = tileBytes;
+            if (uncompress(scratch.data(), &unpacked, planes, index[1]) != Z_OK || unpacked != tileBytes) {
+                return false;
+            }
+            planes = scratch.data();
+        } else if (index[1] != tileBytes) {
+            return false;
+        }
+        tile.iterations = (const int32_t*) planes;
+        planes += tilePixels * 4;
+        tile.smooth = channels() & channel_smooth ? (const float*) planes : nullptr;
+        planes += tile.smooth ? tilePixels * 4 : 0;
+        tile.distance = channels() & channel_distance ? (const float*) planes : nullptr;
+        return true;
+    }
+
+    /**
+     * @brief
+     * Copy the width x height region at (left, top) into <frame>, with the channels stored in the file.
+     */
+    bool readRegion(int left, int top, int width, int height, FrameBuffer& frame) const
+    {
+        frame.width = width;
+        frame.height = height;
+        frame.iterations.resize((size_t) width * height);
+        frame.smooth.resize(channels() & channel_smooth ? frame.iterations.size() : 0);
+        frame.distance.resize(channels() & channel_distance ? frame.iterations.size() : 0);
+        const int size = tileSize();
+        const int xFirst = left / size, xLast = (left + width - 1) / size;
+        const int yFirst = top / size, yLast = (top + height - 1) / size;
+        const int nColumns = xLast - xFirst + 1;
+        std::atomic<bool> ok(true);
+        parallelFor(nColumns * (yLast - yFirst + 1), [&](int k) {
+            int x = xFirst + k % nColumns;
+            int y = yFirst + k / nColumns;
+            std::vector<uint8_t> scratch;
+            IterationTile tile;
+            if (!readTile(x, y, tile, scratch)) {
+                ok = false;
+                return;
+            }
+            int iStart = std::max(left, x * size), iEnd = std::min(left + width, (x + 1) * size);
+            int jStart = std::max(top, y * size), jEnd = std::min(top + height, (y + 1) * size);
+            for (int j = jStart; j < jEnd; ++j) {
+                size_t source = (size_t) (j - y * size) * size + iStart - x * size;
+                size_t target = (size_t) (j - top) * width + iStart - left;
+                std::copy_n(tile.iterations + source, iEnd - iStart, frame.iterations.begin() + target);
+                if (tile.smooth) std::copy_n(tile.smooth + source, iEnd - iStart, frame.smooth.begin() + target);
+                if (tile.distance) std::copy_n(tile.distance + source, iEnd - iStart, frame.distance.begin() + target);
+            }
+        });
+        return ok;
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    ViewState viewState;
+
+    const uint64_t* tileIndex() const
+    {
+        return (const uint64_t*) (data + sizeof(IterationFileHeader) + header().viewLength);
+    }
+
+    bool validate()
+    {
+        const IterationFileHeader& h = header();
+        if (memcmp(h.magic, iteration_file_magic, 8) != 0 || h.width == 0 || h.height == 0 || h.tileSize == 0
+            || !(h.channels & channel_iterations) || h.maxIterations <= 0 || h.viewLength % 8 != 0) {
+            return false;
+        }
+        // written so that lengths from the file cannot overflow
+        const size_t indexStart = sizeof(IterationFileHeader) + h.viewLength;
+        if (indexStart > size || iterationFileTileCount(h) > (size - indexStart) / (2 * sizeof(uint64_t))) return false;
+        const size_t indexEnd = indexStart + 2 * sizeof(uint64_t) * iterationFileTileCount(h);
+        std::string viewText((const char*) data + sizeof(IterationFileHeader), h.viewLength);
+        if (!ViewState::fromString(viewText, viewState)) return false;
+        const uint64_t* index = tileIndex();
+        for (size_t k = 0; k < iterationFileTileCount(h); ++k) {
+            if (index[2*k] < indexEnd || index[2*k] > size || index[2*k+1] > size - index[2*k]) return false;
+        }
+        return true;
+    }
+};
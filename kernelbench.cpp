@@ -0,0 +1,317 @@
+// Micro-benchmark of the escape-time kernels: every kernel iterates fixed sets of
+// exterior, boundary and interior points on one thread, repeatedly, and the time per
+// iteration is reported with its spread over the repetitions, along with instructions per
+// cycle and branch and cache misses per iteration where hardware counters are available.
+#include "engine.h"
+#include "perfcounters.h"
+#include "viewstate.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef struct PointSet
+{
+    std::string name;
+    std::vector<double> re, im;
+} PointSet;
+
+typedef struct BenchmarkOptions
+{
+    int maxIterations = 1000;
+    int points = 2048;
+    int repetitions = 11;
+    std::string kernel; // only kernels whose name contains this
+} BenchmarkOptions;
+
+// a kernel iterates all points of a set and returns the iterations spent
+typedef std::function<double(const PointSet&, int maxIterations)> Kernel;
+
+/**
+ * @brief
+ * The same loop as iterateMandelbrot in single precision, as computed by the GLSL shaders.
+ */
+static int iterateFloat(float a, float b, int maxIterations)
+{
+    float tmp_a = a;
+    float tmp_b = b;
+    for (int i = 0; i < maxIterations; ++i) {
+        float original_a = tmp_a;
+        tmp_a = original_a*original_a - tmp_b*tmp_b + a;
+        tmp_b = 2*original_a*tmp_b + b;
+        if (tmp_a*tmp_a + tmp_b*tmp_b > 4.0f) {
+            return i;
+        }
+    }
+    return maxIterations;
+}
+
+/**
+ * @brief
+ * Candidate kernel, not used by the renderer: iterateMandelbrot for <lanes> points in
+ * lockstep, written so that the compiler can keep the lanes in SIMD registers.
+ * Lanes that escaped keep iterating with their count frozen until all have escaped.
+ */
+template <int lanes>
+static void iterateBatch(const double* a, const double* b, int maxIterations, int* result)
+{
+    double za[lanes], zb[lanes];
+    int count[lanes];
+    for (int l = 0; l < lanes; ++l) {
+        za[l] = a[l];
+        zb[l] = b[l];
+        count[l] = maxIterations;
+    }
+    for (int i = 0; i < maxIterations; ++i) {
+        bool active = false;
+        for (int l = 0; l < lanes; ++l) {
+            double original_a = za[l];
+            za[l] = original_a*original_a - zb[l]*zb[l] + a[l];
+            zb[l] = 2*original_a*zb[l] + b[l];
+            bool escaped = za[l]*za[l] + zb[l]*zb[l] > convergence_radius_squared;
+            // escaped lanes are clamped, so that they do not overflow to inf/nan
+            za[l] = escaped ? 2.0 : za[l];
+            zb[l] = escaped ? 2.0 : zb[l];
+            count[l] = escaped && count[l] == maxIterations ? i : count[l];
+            active |= count[l] == maxIterations;
+        }
+        if (!active) break;
+    }
+    for (int l = 0; l < lanes; ++l) {
+        result[l] = count[l];
+    }
+}
+
+// double-double arithmetic: a value is hi + lo with |lo| <= ulp(hi) / 2
+typedef struct DoubleDouble
+{
+    double hi, lo;
+} DoubleDouble;
+
+static DoubleDouble ddAdd(DoubleDouble a, DoubleDouble b)
+{
+    double s = a.hi + b.hi;
+    double v = s - a.hi;
+    double e = (a.hi - (s - v)) + (b.hi - v) + a.lo + b.lo;
+    double hi = s + e;
+    return {hi, e - (hi - s)};
+}
+
+static DoubleDouble ddMul(DoubleDouble a, DoubleDouble b)
+{
+    double p = a.hi * b.hi;
+    double e = std::fma(a.hi, b.hi, -p) + a.hi * b.lo + a.lo * b.hi;
+    double hi = p + e;
+    return {hi, e - (hi - p)};
+}
+
+/**
+ * @brief
+ * Candidate kernel, not used by the renderer: iterateMandelbrot in double-double precision
+ * (about 106 bits), the alternative to perturbation for moderately deep zooms.
+ */
+static int iterateDoubleDouble(double a, double b, int maxIterations)
+{
+    DoubleDouble ca = {a, 0.0}, cb = {b, 0.0};
+    DoubleDouble za = ca, zb = cb;
+    for (int i = 0; i < maxIterations; ++i) {
+        DoubleDouble aa = ddMul(za, za);
+        DoubleDouble bb = ddMul(zb, zb);
+        DoubleDouble ab = ddMul(za, zb);
+        za = ddAdd(ddAdd(aa, {-bb.hi, -bb.lo}), ca);
+        zb = ddAdd({2 * ab.hi, 2 * ab.lo}, cb);
+        if (za.hi*za.hi + zb.hi*zb.hi > convergence_radius_squared) {
+            return i;
+        }
+    }
+    return maxIterations;
+}
+
+static double spent(int n, int maxIterations)
+{
+    return std::min(n + 1, maxIterations);
+}
+
+/**
+ * @brief
+ * Fixed pseudo-random points of the region around the set whose escape count (with
+ * iterateMandelbrot) is in [minCount, maxCount].
+ */
+static PointSet createPoints(const std::string& name, int count, int minCount, int maxCount, int maxIterations,
+    uint32_t seed)
+{
+    PointSet set;
+    set.name = name;
+    uint32_t random = seed;
+    while ((int) set.re.size() < count) {
+        random = hashPixel(random);
+        double a = -2.1 + 2.8 * (random & 0xffff) / 65536.0;
+        double b = -1.3 + 2.6 * (random >> 16) / 65536.0;
+        int n = iterateMandelbrot(a, b, maxIterations);
+        if (n >= minCount && n <= maxCount) {
+            set.re.push_back(a);
+            set.im.push_back(b);
+        }
+    }
+    return set;
+}
+
+static std::vector<std::pair<std::string, Kernel>> createKernels()
+{
+    // perturbation around a point of the main cardioid, whose orbit never escapes
+    static ReferenceOrbit reference;
+    static const double reference_a = -0.25, reference_b = 0.25;
+    std::vector<std::pair<std::string, Kernel>> kernels;
+    kernels.push_back({"double", [](const PointSet& set, int maxIterations) {
+        double total = 0;
+        for (size_t k = 0; k < set.re.size(); ++k) {
+            total += spent(iterateMandelbrot(set.re[k], set.im[k], maxIterations), maxIterations);
+        }
+        return total;
+    }});
+    kernels.push_back({"double+details", [](const PointSet& set, int maxIterations) {
+        double total = 0;
+        for (size_t k = 0; k < set.re.size(); ++k) {
+            float smooth, distance;
+            total += spent(iterateMandelbrot(set.re[k], set.im[k], maxIterations, &smooth, &distance), maxIterations);
+        }
+        return total;
+    }});
+    kernels.push_back({"float", [](const PointSet& set, int maxIterations) {
+        double total = 0;
+        for (size_t k = 0; k < set.re.size(); ++k) {
+            total += spent(iterateFloat((float) set.re[k], (float) set.im[k], maxIterations), maxIterations);
+        }
+        return total;
+    }});
+    kernels.push_back({"batch4", [](const PointSet& set, int maxIterations) {
+        double total = 0;
+        int result[4];
+        for (size_t k = 0; k + 4 <= set.re.size(); k += 4) {
+            iterateBatch<4>(&set.re[k], &set.im[k], maxIterations, result);
+            for (int n : result) total += spent(n, maxIterations);
+        }
+        return total;
+    }});
+    kernels.push_back({"double-double", [](const PointSet& set, int maxIterations) {
+        double total = 0;
+        for (size_t k = 0; k < set.re.size(); ++k) {
+            total += spent(iterateDoubleDouble(set.re[k], set.im[k], maxIterations), maxIterations);
+        }
+        return total;
+    }});
+    auto perturbed = [](bool details) {
+        return [details](const PointSet& set, int maxIterations) {
+            if ((int) reference.re.size() < maxIterations + maxExtraIterations + 2) {
+                reference = computeReferenceOrbit(ViewState::fromDoubles(reference_a, reference_b, 1.0),
+                    maxIterations + maxExtraIterations + 2);
+            }
+            double total = 0;
+            for (size_t k = 0; k < set.re.size(); ++k) {
+                float smooth, distance;
+                int n = iteratePerturbed(reference, set.re[k] - reference_a, set.im[k] - reference_b, maxIterations,
+                    details ? &smooth : nullptr, details ? &distance : nullptr);
+                total += spent(n, maxIterations);
+            }
+            return total;
+        };
+    };
+    kernels.push_back({"perturbation", perturbed(false)});
+    kernels.push_back({"perturbation+details", perturbed(true)});
+    return kernels;
+}
+
+static void printUsage(const char* program)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --iterations <n>    iteration limit (default 1000)\n"
+        "  --points <n>        points per set (default 2048)\n"
+        "  --repetitions <n>   timed runs per kernel and set, after one warm-up run (default 11)\n"
+        "  --kernel <name>     only kernels whose name contains <name>\n",
+        program);
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    for (int k = 1; k < argc; ++k) {
+        std::string arg = argv[k];
+        if (k + 1 >= argc) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (arg == "--iterations") {
+            options.maxIterations = std::max(10, atoi(argv[++k]));
+        } else if (arg == "--points") {
+            options.points = std::max(4, atoi(argv[++k]) / 4 * 4);
+        } else if (arg == "--repetitions") {
+            options.repetitions = std::max(1, atoi(argv[++k]));
+        } else if (arg == "--kernel") {
+            options.kernel = argv[++k];
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const int maxIterations = options.maxIterations;
+    std::vector<PointSet> sets = {
+        createPoints("exterior", options.points, 2, 50, maxIterations, 1),
+        createPoints("boundary", options.points, maxIterations / 20, maxIterations - 1, maxIterations, 2),
+        createPoints("interior", options.points, maxIterations, maxIterations, maxIterations, 3),
+    };
+
+    PerfCounters counters;
+    if (!counters.open()) {
+        fprintf(stderr, "Hardware counters unavailable (%s)\n", counters.error().c_str());
+    }
+    printf("%-22s %-9s %12s %12s %8s %12s %6s %12s %12s\n", "kernel", "points", "ns/iter", "min", "spread",
+        "Miter/s", "IPC", "br-miss/it", "$-miss/it");
+    for (const auto& [name, kernel] : createKernels()) {
+        if (name.find(options.kernel) == std::string::npos) continue;
+        for (const PointSet& set : sets) {
+            kernel(set, maxIterations); // warm-up: caches, branch predictors, clock frequency
+            std::vector<double> nanoseconds;
+            double totalIterations = 0;
+            counters.start();
+            for (int r = 0; r < options.repetitions; ++r) {
+                auto start = std::chrono::steady_clock::now();
+                double iterations = kernel(set, maxIterations);
+                auto end = std::chrono::steady_clock::now();
+                nanoseconds.push_back(std::chrono::duration<double, std::nano>(end - start).count() / iterations);
+                totalIterations += iterations;
+            }
+            PerfCounts counts = counters.stop();
+            std::sort(nanoseconds.begin(), nanoseconds.end());
+            const double median = nanoseconds[nanoseconds.size() / 2];
+            // median absolute deviation relative to the median
+            std::vector<double> deviations;
+            for (double ns : nanoseconds) {
+                deviations.push_back(std::fabs(ns - median));
+            }
+            std::sort(deviations.begin(), deviations.end());
+            const double spread = deviations[deviations.size() / 2] / median;
+            printf("%-22s %-9s %12.3f %12.3f %7.1f%% %12.1f", name.c_str(), set.name.c_str(), median,
+                nanoseconds.front(), 100 * spread, 1e3 / median);
+            if (counts.ipc() > 0) {
+                printf(" %6.2f", counts.ipc());
+            } else {
+                printf(" %6s", "-");
+            }
+            for (int c : {counter_branch_misses, counter_cache_misses}) {
+                if (counts.available[c]) {
+                    printf(" %12.5f", counts.value[c] / totalIterations);
+                } else {
+                    printf(" %12s", "-");
+                }
+            }
+            printf("\n");
+        }
+    }
+    return EXIT_SUCCESS;
+}
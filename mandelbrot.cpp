@@ -6,6 +6,10 @@
 #include "linmath.h"
 #include "rainbow.h"
 #include "shaders.h"
+#include "viewstate.h"
+#include "engine.h"
+#include "equalize.h"
+#include "frametiming.h"
  
 #include <stdlib.h>
 #include <stddef.h>
@@ -14,30 +18,47 @@
 #include <iostream> 
 #include <algorithm> 
 
-// for any complex number with magnitude larger than 2 the iteration will not converge
-const float convergence_radius_squared = 4.0f;
-// after how many interations to stop. this is a global value for now, but maybe a local adaptivtiy is possible
-const int nIterations = 500;
+// after how many interations to stop. chosen per view unless auto_iterations is off
+const int default_iterations = 500;
+int nIterations = default_iterations;
+// pick nIterations for every view with chooseIterationLimit, toggled with I
+bool auto_iterations = true;
 // how much space between graph and edge of window
 const float margin = 0.0;
 // initial range from (boundary - i boundary) to (boundary + i boundary)
-const float boundary = 1.1;
-
-float real_0 = -0.6f;
-float imaginary_0 = 0.0f;
-float zoom_factor = 1.0f;
-
-// float real_0 = -1.21235;
-// float imaginary_0 = 0.318563;
-// float zoom_factor = 1/0.0190757;
-
-// float real_0 = -1.21235;
-// float imaginary_0 = 0.318989;
-// float zoom_factor = 1/1.41981e-05;
-
-// float real_0 = -1.21235;
-// float imaginary_0 = 0.17145;
-// float zoom_factor = 21.1809;
+const double boundary = 1.1;
+
+// window center and zoom factor, see ViewState::fromString for the format
+const char* default_view = "-0.6 0 1";
+// const char* default_view = "-1.21235 0.318563 1/0.0190757";
+// const char* default_view = "-1.21235 0.318989 1/1.41981e-05";
+// const char* default_view = "-1.21235 0.17145 21.1809";
+
+ViewState view;
+// color by the continuous iteration count instead of the integer one, toggled with S
+bool smooth_coloring = false;
+// supersample pixels near the boundary of the set, toggled with X
+bool antialiasing = false;
+SupersampleOptions supersample_options;
+// palettes cycled with P
+const char* const palettes[] = {"inferno", "rainbow", "bw"};
+int palette_index = 0;
+// spread the palette evenly over the pixels of the frame (histogram equalization), toggled with E
+bool equalize_colors = false;
+// set by key presses that require recalculating the frame
+bool needs_update = false;
+// set by key presses that only change the colors of the frame
+bool needs_recolor = false;
+// escape-time data of the current frame
+FrameBuffer frame;
+// escape histogram of the current frame, for equalize_colors
+EscapeHistogram frame_histogram;
+// time spent per stage of each frame
+FrameTimer frame_timer;
+// draw the frame times over the image and show them in the window title, toggled with T
+bool show_timing = false;
+// R starts recording the spans of the engine's threads, pressing it again writes them here
+const char* const trace_path = "mandelbrot-trace.json";
 
 // holds information about each calculated complex number
 typedef struct Vertex
@@ -47,17 +68,6 @@ typedef struct Vertex
     vec3 color;
 } Vertex;
 
-// starting and ending values for real and imaginary part
-typedef struct SampleDimensions
-{
-    float xStart;
-    float xEnd;
-    float dx;
-    float yStart;
-    float yEnd;
-    float dy;
-} SampleDimensions;
-
  
 static void error_callback(int error, const char* description)
 {
@@ -68,179 +78,223 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
         glfwSetWindowShouldClose(window, GLFW_TRUE);
-}
-
-SampleDimensions createDimensions(int xSteps, int ySteps)
-{
-    SampleDimensions s;
-    s.xStart = real_0 - (boundary / zoom_factor);
-    s.xEnd = real_0 + (boundary / zoom_factor);
-    s.dx = (s.xEnd - s.xStart) / xSteps;
-    
-    s.yStart = imaginary_0 - (boundary / zoom_factor);
-    s.yEnd = imaginary_0 + (boundary / zoom_factor);
-    s.dy = (s.yEnd - s.yStart) / ySteps;
-    return s;
-}
-/**
- * @brief
- * For a complex number c = a + bi, count how many iterations it takes
- * until the magnitude of z_n = z^2_n-1 + c is larger than 2.
- * 
- * @param a real value of input complex number
- * @param b imaginary value of input complex number
- * @param maxIterations after how many interations to stop
- */
-int iterateMandelbrot(float a, float b, int maxIterations)
-{
-    float tmp_a = a;
-    float tmp_b = b;
-    for (int i = 0; i < maxIterations; ++i) {
-        float original_a = tmp_a;
-        float original_b = tmp_b;
-        tmp_a = original_a*original_a - original_b*original_b + a;
-        tmp_b = 2*original_a*original_b + b;
-        if (tmp_a*tmp_a + tmp_b*tmp_b > convergence_radius_squared) {
-            return i;
+    if (key == GLFW_KEY_S && action == GLFW_PRESS) {
+        smooth_coloring = !smooth_coloring;
+        needs_update = true;
+    }
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        auto_iterations = !auto_iterations;
+        nIterations = default_iterations;
+        needs_update = true;
+    }
+    if (key == GLFW_KEY_X && action == GLFW_PRESS) {
+        antialiasing = !antialiasing;
+        needs_update = true;
+    }
+    if (key == GLFW_KEY_E && action == GLFW_PRESS) {
+        equalize_colors = !equalize_colors;
+        needs_recolor = true;
+    }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        palette_index = (palette_index + 1) % (int) (sizeof(palettes) / sizeof(palettes[0]));
+        std::cout << "palette " << palettes[palette_index] << "\n";
+        needs_recolor = true;
+    }
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        show_timing = !show_timing;
+    }
+    if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+        // frames are computed on this thread, so no spans are being recorded right now
+        if (!traceEnabled) {
+            startTrace();
+            printf("Recording trace, press R again to write %s\n", trace_path);
+        } else {
+            traceEnabled = false;
+            if (writeTrace(trace_path)) {
+                printf("Trace written to %s\n", trace_path);
+            } else {
+                fprintf(stderr, "Failed to write %s\n", trace_path);
+            }
         }
     }
-    return maxIterations;
 }
 
-void populateVector(std::vector<float>& vec, float start, float delta)
+void populateVector(std::vector<double>& vec, double start, double delta)
 {
     for (size_t j = 0; j < vec.size(); j++) {
         vec[j] = j*delta + start;
     }
 }
 
-void calculatePlotValues(std::vector<float>& plotValues, std::vector<float>& input, float start, float end, float margin)
+void calculatePlotValues(std::vector<float>& plotValues, std::vector<double>& input, double start, double end, float margin)
 {
     for (size_t i = 0; i < plotValues.size(); ++i) {
         plotValues[i] = (input[i]-start)/(end - start) * 2 * (1-margin) - (1-margin);
     }
 }
 
-template <typename Callable>
-void createRGBVectors(int nIterations, 
-    std::vector<float>& r, 
-    std::vector<float>& g, 
-    std::vector<float>& b,
-    Callable colorFunction
-)
-{
-    float rr, gg, bb;
-    for (int i = 0; i <= nIterations; ++i) {
-        colorFunction(i, nIterations, rr, gg, bb);
-        r[i] = rr;
-        g[i] = gg;
-        b[i] = bb;
-    }
-}
-
 /**
  * @brief
  * Calculate color values of all pixels in the window
  * 
+ * @param vertices one vertex per pixel, row by row
  * @param width window width
  * @param height window height
- * @param real_0 real value of window center
- * @param imaginary_0 imaginary value of window center
- * @param zoom_factor If 1, window width accounts for real value length of 2.2
+ * @param recolor_only only color the current frame again, e.g. after a palette change
+ *
+ * The window center and zoom factor are taken from <view>.
+ * At zoom factor 1, window width accounts for real value length of 2.2.
  */
-std::vector<Vertex> createVertices(int width, int height)
+void updateVertices(std::vector<Vertex> &vertices, int width, int height, bool recolor_only = false)
 {
-    float x;
     int xSteps = width;
-    float y;
     int ySteps = height;
+    SampleDimensions dimensions = createDimensions(view, boundary, xSteps, ySteps);
+    recolor_only = recolor_only && frame.width == xSteps && frame.height == ySteps;
+    if (auto_iterations && !recolor_only) {
+        IterationLimitOptions limitOptions;
+        limitOptions.maxIterations = interactive_max_iterations;
+        nIterations = chooseIterationLimit(dimensions, limitOptions);
+        std::cout << "iterations " << nIterations << "\n";
+    }
 
-    SampleDimensions dimensions = createDimensions(xSteps, ySteps);
-
-    std::vector<float> xInput(xSteps), yInput(ySteps);
+    std::vector<double> xInput(xSteps), yInput(ySteps);
     populateVector(xInput, dimensions.xStart, dimensions.dx);
     populateVector(yInput, dimensions.yStart, dimensions.dy);
 
-    std::vector<float> r(nIterations+1), g(nIterations+1), b(nIterations+1);
-    // createRGBVectors(nIterations, r, g, b, intToRainbowRGB);
-    createRGBVectors(nIterations, r, g, b, intToInferno);
-    
-
     std::vector<float> yPlotValues(ySteps), xPlotValues(xSteps);
     calculatePlotValues(yPlotValues, yInput, dimensions.yStart, dimensions.yEnd, margin);
     calculatePlotValues(xPlotValues, xInput, dimensions.xStart, dimensions.xEnd, margin);
-    float yPlotValue, xPlotValue;
 
-    std::vector<Vertex> vertices(ySteps*xSteps);
-    for (size_t j = 0; j < yInput.size(); j++) {
-        y = yInput[j];
-        yPlotValue = yPlotValues[j];
-        for (size_t i = 0; i < xInput.size(); i++) {
-            xPlotValue = xPlotValues[i];
-            x = xInput[i];
-            int myIterations = iterateMandelbrot(x, y, nIterations);
+    if (!recolor_only) {
+        frame_histogram = EscapeHistogram();
+        renderFrame(dimensions, xSteps, ySteps, nIterations, frame, smooth_coloring || antialiasing, nullptr,
+            &frame_histogram);
+        frame_timer.mark(stage_compute);
+    }
+
+    std::vector<float> r(nIterations+1), g(nIterations+1), b(nIterations+1);
+    ColorFunction palette = colorFunctionByName(palettes[palette_index]);
+    if (equalize_colors) {
+        createEqualizedRGBVectors(frame_histogram, nIterations, r, g, b, palette);
+    } else {
+        createRGBVectors(nIterations, r, g, b, palette);
+    }
 
-            Vertex current_vertex;
-            current_vertex.true_position[0] = x;
-            current_vertex.true_position[1] = y;
-            current_vertex.position[0] = xPlotValue;
-            current_vertex.position[1] = yPlotValue;
-            current_vertex.color[0] = r[myIterations];
-            current_vertex.color[1] = g[myIterations];
-            current_vertex.color[2] = b[myIterations]; 
-            vertices[j*xSteps + i] = current_vertex;
+    auto colorize = [&](int iterations, float smooth, float& rr, float& gg, float& bb) {
+        if (smooth_coloring) {
+            interpolateRGB(smooth, r, g, b, rr, gg, bb);
+        } else {
+            rr = r[iterations];
+            gg = g[iterations];
+            bb = b[iterations];
+        }
+    };
+    std::vector<float> colors(3 * frame.iterations.size());
+    parallelFor(ySteps, [&](int j) {
+        for (size_t index = (size_t) j*xSteps; index < (size_t) (j+1)*xSteps; ++index) {
+            float smooth = smooth_coloring ? frame.smooth[index] : 0.0f;
+            colorize(frame.iterations[index], smooth, colors[3*index], colors[3*index+1], colors[3*index+2]);
         }
+    });
+    frame_timer.mark(stage_colorize);
+    if (antialiasing) {
+        size_t count = supersampleFrame(dimensions, nIterations, frame, supersample_options, colorize, colors);
+        std::cout << "supersampled " << count << " of " << frame.iterations.size() << " pixels\n";
+        frame_timer.mark(stage_compute);
     }
 
-    return vertices;
+    for (int j = 0; j < ySteps; j++) {
+        for (int i = 0; i < xSteps; i++) {
+            size_t index = (size_t) j*xSteps + i;
+            Vertex& current_vertex = vertices[index];
+            current_vertex.true_position[0] = xInput[i];
+            current_vertex.true_position[1] = yInput[j];
+            current_vertex.position[0] = xPlotValues[i];
+            current_vertex.position[1] = yPlotValues[j];
+            current_vertex.color[0] = colors[3*index];
+            current_vertex.color[1] = colors[3*index+1];
+            current_vertex.color[2] = colors[3*index+2];
+        }
+    }
+    frame_timer.mark(stage_colorize);
 }
 
-void updateVertices(std::vector<Vertex> &vertices, int width, int height)
+/**
+ * @brief
+ * Bar chart of the last frame times in the bottom left corner, one column per frame
+ * with the stages stacked, as triangles in window coordinates (-1 ... 1).
+ * A white line marks 1/60 s.
+ */
+void createTimingOverlay(std::vector<Vertex>& overlay, const FrameTimer& timer, int width, int height)
 {
-    float x;
-    int xSteps = width;
-
-    float y;
-    int ySteps = height;
-    SampleDimensions dimensions = createDimensions(xSteps, ySteps);
-
-    std::vector<float> xInput(xSteps), yInput(ySteps);
-    populateVector(xInput, dimensions.xStart, dimensions.dx);
-    populateVector(yInput, dimensions.yStart, dimensions.dy);
-
-    std::vector<float> r(nIterations+1), g(nIterations+1), b(nIterations+1);
-    createRGBVectors(nIterations, r, g, b, intToInferno);
-
-    std::vector<float> yPlotValues(ySteps), xPlotValues(xSteps);
-    calculatePlotValues(yPlotValues, yInput, dimensions.yStart, dimensions.yEnd, margin);
-    calculatePlotValues(xPlotValues, xInput, dimensions.xStart, dimensions.xEnd, margin);
-    float yPlotValue, xPlotValue;
-
-    for (size_t j = 0; j < yInput.size(); j++) {
-        y = yInput[j];
-        yPlotValue = yPlotValues[j];
-        for (size_t i = 0; i < xInput.size(); i++) {
-            x = xInput[i];
-            xPlotValue = xPlotValues[i];
-            int myIterations = iterateMandelbrot(x, y, nIterations);
-
-            Vertex& current_vertex = vertices[j*xSteps + i];
-            current_vertex.true_position[0] = x;
-            current_vertex.true_position[1] = y;
-            current_vertex.position[0] = xPlotValue;
-            current_vertex.position[1] = yPlotValue;
-            current_vertex.color[0] = r[myIterations];
-            current_vertex.color[1] = g[myIterations];
-            current_vertex.color[2] = b[myIterations]; 
+    const float columnWidth = 3; // pixels
+    const float pixelsPerMillisecond = 4;
+    overlay.clear();
+    auto quad = [&](float left, float bottom, float right, float top, const float* color) {
+        const float corners[6][2] = {{left, bottom}, {right, bottom}, {right, top},
+                                     {left, bottom}, {right, top}, {left, top}};
+        for (const auto& corner : corners) {
+            Vertex v;
+            v.true_position[0] = v.true_position[1] = 0;
+            v.position[0] = -1 + 2 * corner[0] / width;
+            v.position[1] = -1 + 2 * corner[1] / height;
+            v.color[0] = color[0];
+            v.color[1] = color[1];
+            v.color[2] = color[2];
+            overlay.push_back(v);
+        }
+    };
+    const int columns = (int) std::min<long>(timer.frameCount(), FrameTimer::history_length);
+    for (int age = 0; age < columns; ++age) {
+        // the newest frame on the right
+        float left = (FrameTimer::history_length - 1 - age) * columnWidth;
+        float bottom = 0;
+        for (int s = 0; s < stage_count; ++s) {
+            float top = bottom + 1e3f * (float) timer.recent(age).seconds[s] * pixelsPerMillisecond;
+            quad(left, bottom, left + columnWidth, top, frame_stage_colors[s]);
+            bottom = top;
         }
     }
+    const float white[3] = {1, 1, 1};
+    const float line = 1e3f / 60 * pixelsPerMillisecond;
+    quad(0, line, FrameTimer::history_length * columnWidth, line + 1, white);
+}
+
+std::vector<Vertex> createVertices(int width, int height)
+{
+    std::vector<Vertex> vertices((size_t) width*height);
+    updateVertices(vertices, width, height);
+    return vertices;
 }
 
  
-int main(void)
+int main(int argc, char** argv)
 {
     int width = 1000;
     int height = 1000;
+
+    // an optional view "<real> <imaginary> <zoom>" on the command line, e.g. as printed while exploring,
+    // and optionally --timing-log <file> to write the time of every frame as CSV
+    std::string view_text = default_view;
+    std::vector<std::string> view_arguments;
+    for (int k = 1; k < argc; ++k) {
+        if (std::string(argv[k]) == "--timing-log" && k + 1 < argc) {
+            if (!frame_timer.openLog(argv[++k])) {
+                fprintf(stderr, "Failed to open %s\n", argv[k]);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            view_arguments.push_back(argv[k]);
+        }
+    }
+    if (view_arguments.size() == 3) {
+        view_text = view_arguments[0] + " " + view_arguments[1] + " " + view_arguments[2];
+    }
+    if (!ViewState::fromString(view_text, view)) {
+        fprintf(stderr, "Invalid view: %s\n", view_text.c_str());
+        exit(EXIT_FAILURE);
+    }
      
     glfwSetErrorCallback(error_callback);
  
@@ -299,6 +353,21 @@ int main(void)
     glEnableVertexAttribArray(vcol_location);
     glVertexAttribPointer(vcol_location, 3, GL_FLOAT, GL_FALSE,
                           sizeof(Vertex), (void*) offsetof(Vertex, color));
+
+    // frame time overlay, drawn with the same program
+    std::vector<Vertex> overlay;
+    GLuint overlay_buffer, overlay_array;
+    glGenBuffers(1, &overlay_buffer);
+    glGenVertexArrays(1, &overlay_array);
+    glBindVertexArray(overlay_array);
+    glBindBuffer(GL_ARRAY_BUFFER, overlay_buffer);
+    glEnableVertexAttribArray(vpos_location);
+    glVertexAttribPointer(vpos_location, 2, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex), (void*) offsetof(Vertex, position));
+    glEnableVertexAttribArray(vcol_location);
+    glVertexAttribPointer(vcol_location, 3, GL_FLOAT, GL_FALSE,
+                          sizeof(Vertex), (void*) offsetof(Vertex, color));
+    bool showing_timing = false;
  
     while (!glfwWindowShouldClose(window))
     {
@@ -309,32 +378,40 @@ int main(void)
         }
 
         bool update_vertices = true;
-        if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-            real_0 += 0.1f / zoom_factor;
+        bool recolor_only = false;
+        if (needs_update) {
+            needs_update = false;
+            needs_recolor = false;
+        } else if (needs_recolor) {
+            needs_recolor = false;
+            recolor_only = true;
+        } else if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
+            view.pan(0.1, 0.0);
         } else if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-            real_0 -= 0.1f / zoom_factor;
+            view.pan(-0.1, 0.0);
         } else if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-            imaginary_0 += 0.1f / zoom_factor;
+            view.pan(0.0, 0.1);
         } else if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-            imaginary_0 -= 0.1f / zoom_factor;
+            view.pan(0.0, -0.1);
         } else if (glfwGetKey(window, GLFW_KEY_PERIOD) == GLFW_PRESS) {
-            zoom_factor *= 1.5f;
+            view.zoom(1.5);
         } else if (glfwGetKey(window, GLFW_KEY_COMMA) == GLFW_PRESS) {
-            zoom_factor /= 1.5f;
+            view.zoom(1 / 1.5);
         } else {
             update_vertices = false;
         }
 
         if (update_vertices) {
-            std::cout << real_0 << " " << imaginary_0 << " " << zoom_factor << "\n";
+            std::cout << view.toString() << "\n";
             std::cout << vertices.size() << "\n";
             std::cout << vertices[0].position[0] << " " << vertices[0].position[1] << "\n";
             std::cout << vertices[vertices.size()-1].position[0] << " " << vertices[vertices.size()-1].position[1] << "\n";
-            updateVertices(vertices, width, height);
+            updateVertices(vertices, width, height, recolor_only);
         }
 
         glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+        frame_timer.mark(stage_upload);
  
         glClear(GL_COLOR_BUFFER_BIT);
         glPointSize(10);
@@ -346,11 +423,30 @@ int main(void)
         glBindVertexArray(vertex_array);
         glDrawArrays(GL_POINTS, 0, vertices.size());
         // std::cout << vertices[0].true_position[0] << "\t" << vertices[0].position[0] << "\n";
+
+        if (show_timing) {
+            createTimingOverlay(overlay, frame_timer, width, height);
+            glBindBuffer(GL_ARRAY_BUFFER, overlay_buffer);
+            glBufferData(GL_ARRAY_BUFFER, overlay.size() * sizeof(Vertex), overlay.data(), GL_STREAM_DRAW);
+            glBindVertexArray(overlay_array);
+            glDrawArrays(GL_TRIANGLES, 0, overlay.size());
+            if (frame_timer.frameCount() % 30 == 0) {
+                std::string title = "OpenGL Mandelbrot - " + frame_timer.summary();
+                glfwSetWindowTitle(window, title.c_str());
+            }
+        } else if (showing_timing) {
+            glfwSetWindowTitle(window, "OpenGL Mandelbrot");
+        }
+        showing_timing = show_timing;
  
         glfwSwapBuffers(window);
         glfwPollEvents();
+        frame_timer.mark(stage_swap);
+        frame_timer.endFrame(nIterations);
     }
 
+    glDeleteVertexArrays(1, &overlay_array);
+    glDeleteBuffers(1, &overlay_buffer);
     glDeleteVertexArrays(1, &vertex_array);
     glDeleteBuffers(1, &vertex_buffer);
     glDeleteProgram(program);
@@ -9,10 +9,15 @@
 #include <vector>
 #include <iostream> 
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include "linmath.h" 
+#include "viewstate.h"
+#include "engine.h"
 
 
 std::string loadShaderFile(const char* filePath) {
@@ -30,6 +35,19 @@ std::string loadShaderFile(const char* filePath) {
     return buffer.str();
 }
 
+/**
+ * @brief
+ * Insert "#define <name>" lines after the #version line of a shader source.
+ */
+std::string withDefines(const std::string& source, const std::vector<std::string>& names) {
+    std::string defines;
+    for (const std::string& name : names) {
+        defines += "#define " + name + "\n";
+    }
+    size_t end = source.find('\n');
+    return end == std::string::npos ? source : source.substr(0, end + 1) + defines + source.substr(end + 1);
+}
+
 unsigned int compileShader(unsigned int type, const char* source) {
     unsigned int id = glCreateShader(type);
     glShaderSource(id, 1, &source, nullptr);
@@ -45,71 +63,506 @@ unsigned int compileShader(unsigned int type, const char* source) {
     return id;
 }
 
-unsigned int createShaderProgram(unsigned int vs, unsigned int fs) {
+// linked programs are kept here as binaries, see createCachedProgram
+const char* const program_cache_directory = "shader-cache";
+
+typedef struct ShaderSource {
+    unsigned int type;
+    std::string source;
+} ShaderSource;
+
+/**
+ * @brief
+ * File in program_cache_directory for the program linked from <stages>, named by an
+ * FNV-1a hash of their sources and of the vendor, renderer and version strings of the
+ * driver, which may only load binaries it wrote itself.
+ */
+std::string programCachePath(const std::vector<ShaderSource>& stages) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto add = [&hash](const std::string& text) {
+        // with the terminating zero, so that parts cannot run into each other
+        for (size_t n = 0; n <= text.size(); ++n) {
+            hash ^= (unsigned char) text.c_str()[n];
+            hash *= 0x100000001b3ull;
+        }
+    };
+    for (unsigned int name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const char* driver = (const char*) glGetString(name);
+        add(driver ? driver : "");
+    }
+    for (const ShaderSource& stage : stages) {
+        add(std::to_string(stage.type));
+        add(stage.source);
+    }
+    char file[32];
+    snprintf(file, sizeof(file), "%016llx.bin", (unsigned long long) hash);
+    return std::string(program_cache_directory) + "/" + file;
+}
+
+/**
+ * @brief
+ * Create a program from the binary at <path>, as written by saveProgramBinary.
+ *
+ * @return 0 if there is no such file or the driver rejects the binary
+ */
+unsigned int loadProgramBinary(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    uint32_t format;
+    if (!file.read((char*) &format, sizeof(format))) {
+        return 0;
+    }
+    std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
     unsigned int program = glCreateProgram();
-    
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
+    glProgramBinary(program, format, binary.data(), (int) binary.size());
+    int linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+/**
+ * @brief
+ * Write the binary of the linked <program> to <path>: its format as uint32_t, then the
+ * binary. The file is written under a temporary name and renamed, so that an explorer
+ * starting at the same time never reads half of it.
+ */
+void saveProgramBinary(unsigned int program, const std::string& path) {
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        // the driver offers no binary formats
+        return;
+    }
+    std::vector<char> binary(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    std::error_code error;
+    std::filesystem::create_directories(program_cache_directory, error);
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath, std::ios::binary);
+    const uint32_t header = format;
+    file.write((const char*) &header, sizeof(header));
+    file.write(binary.data(), length);
+    file.close();
+    if (!file) {
+        std::filesystem::remove(temporaryPath, error);
+        return;
+    }
+    std::filesystem::rename(temporaryPath, path, error);
+}
+
+/**
+ * @brief
+ * Compile and link a program from <stages>. With OpenGL 4.1, the linked program is
+ * cached by programCachePath and loaded from there on the next start; binaries the
+ * driver rejects (after a driver update, for instance) are compiled and replaced.
+ *
+ * @return 0 if the driver cannot compile or link the stages
+ */
+unsigned int createCachedProgram(const std::vector<ShaderSource>& stages) {
+    const bool binaries = GLAD_GL_VERSION_4_1;
+    std::string path;
+    if (binaries) {
+        path = programCachePath(stages);
+        unsigned int program = loadProgramBinary(path);
+        if (program) {
+            return program;
+        }
+    }
+
+    unsigned int program = glCreateProgram();
+    std::vector<unsigned int> shaders;
+    for (const ShaderSource& stage : stages) {
+        shaders.push_back(compileShader(stage.type, stage.source.c_str()));
+        glAttachShader(program, shaders.back());
+    }
+    if (binaries) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(program);
-    
+    for (unsigned int shader : shaders) {
+        glDeleteShader(shader);
+    }
+
     int success;
     glGetProgramiv(program, GL_LINK_STATUS, &success);
     if (!success) {
         char infoLog[512];
         glGetProgramInfoLog(program, 512, nullptr, infoLog);
         std::cerr << "Shader program linking error:\n" << infoLog << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    if (binaries) {
+        saveProgramBinary(program, path);
     }
-    
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-    
     return program;
 }
 
 int maxRepetitions = 10;
 int defaultMaxRepetitions = maxRepetitions;
+// choose maxRepetitions for every view with chooseIterationLimit; M and N switch to manual, I back to auto
+bool autoRepetitions = true;
+bool viewChanged = true;
+// whether the window needs a new frame; without one, the main loop sleeps in glfwWaitEvents
+bool needsRedraw = true;
+// frames drawn and how many of them ran the iteration pass, printed with P
+long framesRendered = 0;
+long iterationPasses = 0;
 int width = 800;
 int height = 600;
 float aspectRatio = (float) width / height;
-float xCenter = 0;
-float yCenter = 0;
-float zoomFactor = 1.f;
-float defaultXCenter = xCenter;
-float defaultYCenter = yCenter;
-float defaultZoomFactor = zoomFactor;
+// at zoom factor 1 the window height spans 1.0 in the complex plane
+ViewState view = ViewState::fromDoubles(0.5, 0.5, 1.0);
+ViewState defaultView = view;
 int currentFuncIndex = 0; // or 1, etc.
+bool smoothColoring = false;
 const int lengthFuncIndices = 4;
+// variant of texture.frag used for the last frame, printed when it changes
+std::string precisionMode = "single precision";
+// reference orbit of the view center for the PERTURBATION variant of texture.frag
+ReferenceOrbit reference;
+// progressive rendering: iterations all unfinished pixels have done, and how many
+// the next pass adds, adapted so that a pass takes about progressive_pass_seconds
+int iterationsDone = 0;
+int passIterations = 256;
+const double progressive_pass_seconds = 0.02;
+// where OpenGL 4.3 is available, which modes iterate with mandelbrot.comp instead of texture.frag.
+// By default only single precision: with double-single and perturbation, the compute shader
+// was slower on llvmpipe. G cycles through the options.
+enum ComputeShaderUse
+{
+    compute_single_precision,
+    compute_all_modes,
+    compute_off,
+    compute_use_count
+};
+ComputeShaderUse computeShaderUse = compute_single_precision;
+// tile_size of mandelbrot.comp
+const int compute_tile_size = 16;
+
+/**
+ * @brief
+ * Render targets of the iteration pass: the values for colorize.frag, and two sets of
+ * state textures (State0 and State1 of texture.frag). Every pass reads one set and writes
+ * the other, through the framebuffer of that set.
+ */
+typedef struct IterationTargets
+{
+    unsigned int values = 0;
+    unsigned int state[2][2] = {};
+    unsigned int framebuffers[2] = {};
+    int width = 0;
+    int height = 0;
+    // set written by the last pass
+    int current = 0;
+} IterationTargets;
 
 void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
     if (action == GLFW_PRESS || action == GLFW_REPEAT) {
-        float moveSpeed = 0.1f /  zoomFactor; // Slower pan when zoomed in
+        const double moveSpeed = 0.1; // in units of the window height, so panning slows down when zoomed in
+        // whether the key changes what texture.frag computes, rather than only the colors
+        bool iterate = true;
+        bool redraw = true;
         switch (key) {
-            case GLFW_KEY_W: yCenter += moveSpeed; break;
-            case GLFW_KEY_S: yCenter -= moveSpeed; break;
-            case GLFW_KEY_A: xCenter -= moveSpeed; break;
-            case GLFW_KEY_D: xCenter += moveSpeed; break;
-            case GLFW_KEY_Q: zoomFactor *= 1.1f; break; // Zoom in
-            case GLFW_KEY_E: zoomFactor /= 1.1f; break; // Zoom out
-            case GLFW_KEY_M: maxRepetitions += 10; break;
-            case GLFW_KEY_N: maxRepetitions = std::max(10,maxRepetitions-10); break;
-            case GLFW_KEY_C: currentFuncIndex = (currentFuncIndex + 1) % lengthFuncIndices; break;
-            case GLFW_KEY_UP: yCenter += moveSpeed; break;
-            case GLFW_KEY_DOWN: yCenter -= moveSpeed; break;
-            case GLFW_KEY_LEFT: xCenter -= moveSpeed; break;
-            case GLFW_KEY_RIGHT: xCenter += moveSpeed; break;
-            case GLFW_KEY_COMMA: zoomFactor *= 1.1f; break; // Zoom in
-            case GLFW_KEY_PERIOD: zoomFactor /= 1.1f; break; // Zoom out
-            case GLFW_KEY_R: zoomFactor = defaultZoomFactor; xCenter = defaultXCenter; yCenter = defaultYCenter; maxRepetitions = defaultMaxRepetitions; break;
+            case GLFW_KEY_W: view.pan(0, moveSpeed); break;
+            case GLFW_KEY_S: view.pan(0, -moveSpeed); break;
+            case GLFW_KEY_A: view.pan(-moveSpeed, 0); break;
+            case GLFW_KEY_D: view.pan(moveSpeed, 0); break;
+            case GLFW_KEY_Q: view.zoom(1.1); break; // Zoom in
+            case GLFW_KEY_E: view.zoom(1 / 1.1); break; // Zoom out
+            case GLFW_KEY_M: maxRepetitions += 10; autoRepetitions = false; break;
+            case GLFW_KEY_N: maxRepetitions = std::max(10,maxRepetitions-10); autoRepetitions = false; break;
+            case GLFW_KEY_I: autoRepetitions = true; break;
+            case GLFW_KEY_C: currentFuncIndex = (currentFuncIndex + 1) % lengthFuncIndices; iterate = false; break;
+            case GLFW_KEY_T: smoothColoring = !smoothColoring; break;
+            case GLFW_KEY_G: computeShaderUse = (ComputeShaderUse) ((computeShaderUse + 1) % compute_use_count); break;
+            case GLFW_KEY_P:
+                std::cout << view.toString() << " " << maxRepetitions << std::endl;
+                std::cout << framesRendered << " frames, " << iterationPasses << " iteration passes" << std::endl;
+                iterate = false;
+                redraw = false;
+                break;
+            case GLFW_KEY_UP: view.pan(0, moveSpeed); break;
+            case GLFW_KEY_DOWN: view.pan(0, -moveSpeed); break;
+            case GLFW_KEY_LEFT: view.pan(-moveSpeed, 0); break;
+            case GLFW_KEY_RIGHT: view.pan(moveSpeed, 0); break;
+            case GLFW_KEY_COMMA: view.zoom(1.1); break; // Zoom in
+            case GLFW_KEY_PERIOD: view.zoom(1 / 1.1); break; // Zoom out
+            case GLFW_KEY_R: view = defaultView; maxRepetitions = defaultMaxRepetitions; break;
+            default: iterate = false; redraw = false; break;
         }
+        viewChanged = viewChanged || iterate;
+        needsRedraw = needsRedraw || redraw;
     }
 }
 
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
-    zoomFactor *= (yoffset > 0) ? 1.1f : 0.9f;
+    view.zoom((yoffset > 0) ? 1.1 : 0.9);
+    viewChanged = true;
+    needsRedraw = true;
+}
+
+// resizing, and windows that were covered, need a new frame
+void framebufferSizeCallback(GLFWwindow* window, int w, int h) {
+    needsRedraw = true;
+}
+
+void refreshCallback(GLFWwindow* window) {
+    needsRedraw = true;
+}
+
+/**
+ * @brief
+ * The region of the complex plane shown in the window, as computed in texture.frag.
+ */
+SampleDimensions windowDimensions() {
+    SampleDimensions s;
+    const double halfHeight = 0.5 / view.zoomFactor();
+    const double halfWidth = halfHeight * aspectRatio;
+    s.xStart = view.real.toDouble() - halfWidth;
+    s.xEnd = view.real.toDouble() + halfWidth;
+    s.dx = (s.xEnd - s.xStart) / width;
+    s.yStart = view.imaginary.toDouble() - halfHeight;
+    s.yEnd = view.imaginary.toDouble() + halfHeight;
+    s.dy = (s.yEnd - s.yStart) / height;
+    s.xStartOffset = -halfWidth;
+    s.yStartOffset = -halfHeight;
+    return s;
+}
+
+/**
+ * @brief
+ * Whether pixels are too small for float coordinates: once a pixel is only a few float
+ * ulps of the center wide, the float shader shows blocks of equal pixels.
+ */
+bool needsDoubleSingle() {
+    const double pixel = 1.0 / (view.zoomFactor() * height);
+    const double magnitude = std::max({1.0, std::fabs(view.real.toDouble()), std::fabs(view.imaginary.toDouble())});
+    return pixel < 16 * FLT_EPSILON * magnitude;
+}
+
+void allocateTexture(unsigned int texture, int internalFormat, int format, int w, int h) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+}
+
+/**
+ * @brief
+ * (Re)allocate the iteration targets at <w> x <h>: an R32F texture for the values and
+ * RGBA32F textures for the state.
+ */
+void resizeIterationTargets(IterationTargets& targets, int w, int h) {
+    if (!targets.values) {
+        glGenTextures(1, &targets.values);
+        glGenTextures(4, &targets.state[0][0]);
+        glGenFramebuffers(2, targets.framebuffers);
+    }
+    targets.width = w;
+    targets.height = h;
+    allocateTexture(targets.values, GL_R32F, GL_RED, w, h);
+    for (int k = 0; k < 2; ++k) {
+        glBindFramebuffer(GL_FRAMEBUFFER, targets.framebuffers[k]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targets.values, 0);
+        for (int n = 0; n < 2; ++n) {
+            allocateTexture(targets.state[k][n], GL_RGBA32F, GL_RGBA, w, h);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1 + n, GL_TEXTURE_2D, targets.state[k][n], 0);
+        }
+        // outputs FragValue, State0, State1
+        const GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+        glDrawBuffers(3, buffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Iteration framebuffer incomplete" << std::endl;
+        }
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void deleteIterationTargets(IterationTargets& targets) {
+    glDeleteTextures(1, &targets.values);
+    glDeleteTextures(4, &targets.state[0][0]);
+    glDeleteFramebuffers(2, targets.framebuffers);
+}
+
+/**
+ * @brief
+ * Scale passIterations so that the next pass takes about progressive_pass_seconds,
+ * by at most a factor of 2 per pass.
+ */
+void adaptPassIterations(double seconds) {
+    const double factor = std::clamp(progressive_pass_seconds / std::max(seconds, 1e-4), 0.5, 2.0);
+    passIterations = std::clamp((int) (passIterations * factor), 16, 1 << 24);
+}
+
+/**
+ * @brief
+ * Run the next pass of texture.frag <program>, which takes the unfinished pixels from
+ * iterationsDone up to passIterations further. With <restart>, all pixels start over.
+ *
+ * @return whether pixels are unfinished
+ */
+bool runIterationPass(unsigned int program, IterationTargets& targets, bool restart) {
+    const int start = restart ? 0 : iterationsDone;
+    const int end = (int) std::min<long>(maxRepetitions, (long) start + passIterations);
+    const int source = targets.current;
+    const int target = 1 - source;
+    glBindFramebuffer(GL_FRAMEBUFFER, targets.framebuffers[target]);
+    glViewport(0, 0, targets.width, targets.height);
+    glUniform1i(glGetUniformLocation(program, "firstPass"), restart);
+    glUniform1i(glGetUniformLocation(program, "passEnd"), end);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, targets.state[source][0]);
+    glUniform1i(glGetUniformLocation(program, "state0"), 2);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, targets.state[source][1]);
+    glUniform1i(glGetUniformLocation(program, "state1"), 3);
+
+    const double startTime = glfwGetTime();
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glFinish();
+    const double seconds = glfwGetTime() - startTime;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    targets.current = target;
+    iterationsDone = end;
+    ++iterationPasses;
+
+    // passes in which all pixels finished say nothing about the cost of a full pass
+    if (end - start == passIterations) {
+        adaptPassIterations(seconds);
+    }
+    return iterationsDone < maxRepetitions;
+}
+
+/**
+ * @brief
+ * Like runIterationPass with the mandelbrot.comp <program>: every pixel is taken up to
+ * passIterations further, its state is updated in place in the first set of state
+ * textures, and the pass counts the pixels it leaves unfinished in <counterBuffer>.
+ * Since tiles wait for their border, pixels do not all advance alike.
+ *
+ * @return whether pixels are unfinished
+ */
+bool runComputePass(unsigned int program, IterationTargets& targets, unsigned int counterBuffer, bool restart) {
+    const unsigned int zero = 0;
+    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counterBuffer);
+    glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(zero), &zero);
+    glUniform1i(glGetUniformLocation(program, "firstPass"), restart);
+    glUniform1i(glGetUniformLocation(program, "passLength"), passIterations);
+    glBindImageTexture(0, targets.values, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glBindImageTexture(1, targets.state[0][0], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    glBindImageTexture(2, targets.state[0][1], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+    const double startTime = glfwGetTime();
+    glDispatchCompute((targets.width + compute_tile_size - 1) / compute_tile_size,
+        (targets.height + compute_tile_size - 1) / compute_tile_size, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+    unsigned int unfinished;
+    // waits for the dispatch to finish
+    glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(unfinished), &unfinished);
+    const double seconds = glfwGetTime() - startTime;
+    ++iterationPasses;
+
+    if (unfinished > 0) {
+        adaptPassIterations(seconds);
+    }
+    return unfinished > 0;
+}
+
+/**
+ * @brief
+ * Link texture.vert with a variant of texture.frag that has <define> set.
+ *
+ * @return 0 if the driver cannot compile or link the variant
+ */
+unsigned int createVariantProgram(const std::string& vertSource, const std::string& fragSource, const char* define) {
+    return createCachedProgram({{GL_VERTEX_SHADER, vertSource}, {GL_FRAGMENT_SHADER, withDefines(fragSource, {define})}});
+}
+
+/**
+ * @brief
+ * Compute the reference orbit of the view center and upload it to <buffer> as RG32F
+ * texels (re, im). With the automatic limit, maxRepetitions is chosen with the orbit,
+ * which grows with the rounds of chooseIterationLimit; either way it is only computed
+ * as far as maxRepetitions needs.
+ *
+ * @param maxLength texels the buffer texture can hold (GL_MAX_TEXTURE_BUFFER_SIZE)
+ */
+void updateReferenceOrbit(unsigned int buffer, int maxLength) {
+    reference = computeReferenceOrbit(view, 2);
+    if (autoRepetitions) {
+        IterationLimitOptions options;
+        options.maxIterations = std::min(interactive_max_iterations, maxLength - maxExtraIterations - 2);
+        maxRepetitions = chooseIterationLimit(windowDimensions(), options, &reference, [](int limit) {
+            extendReferenceOrbit(view, reference, limit + maxExtraIterations + 2);
+        });
+    }
+    extendReferenceOrbit(view, reference, std::min(maxLength, maxRepetitions + maxExtraIterations + 2));
+    std::vector<float> texels(2 * reference.re.size());
+    for (size_t n = 0; n < reference.re.size(); ++n) {
+        texels[2*n] = (float) reference.re[n];
+        texels[2*n + 1] = (float) reference.im[n];
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, texels.size() * sizeof(float), texels.data(), GL_DYNAMIC_DRAW);
+}
+
+/**
+ * @brief
+ * Compile mandelbrot.comp, appended to the kernels of texture.frag with COMPUTE (and
+ * <define>, if given) set, as compute shader.
+ *
+ * @return 0 if the driver cannot compile or link it
+ */
+unsigned int createComputeProgram(const std::string& fragSource, const std::string& computeSource, const char* define) {
+    std::vector<std::string> defines = {"COMPUTE"};
+    if (define) {
+        defines.push_back(define);
+    }
+    // texture.frag is written for GLSL 3.30
+    std::string source = withDefines("#version 430 core\n" + fragSource.substr(fragSource.find('\n') + 1), defines)
+        + computeSource;
+    return createCachedProgram({{GL_COMPUTE_SHADER, source}});
+}
+
+/**
+ * @brief
+ * Set the uniforms of texture.frag for the current view. The center is passed both as
+ * float and, for the DOUBLE_SINGLE variant, as a pair of floats hi + lo.
+ */
+void setViewUniforms(unsigned int program) {
+    const double re = view.real.toDouble();
+    const double im = view.imaginary.toDouble();
+    const float reHi = (float) re;
+    const float imHi = (float) im;
+    glUniform1f(glGetUniformLocation(program, "zoom"), (float) view.zoomFactor());
+    glUniform2f(glGetUniformLocation(program, "center"), reHi, imHi);
+    glUniform2f(glGetUniformLocation(program, "centerHi"), reHi, imHi);
+    glUniform2f(glGetUniformLocation(program, "centerLo"), (float) (re - reHi), (float) (im - imHi));
+    glUniform1i(glGetUniformLocation(program, "maxRepetitions"), maxRepetitions);
+    glUniform1f(glGetUniformLocation(program, "aspectRatio"), aspectRatio);
+    glUniform1i(glGetUniformLocation(program, "smoothColoring"), smoothColoring);
+    glUniform1i(glGetUniformLocation(program, "referenceLength"), (int) reference.re.size());
 }
 
 
-int main() {
+int main(int argc, char** argv) {
+    // Optional start view "<real> <imaginary> <zoom>", e.g. as printed with P
+    if (argc == 4) {
+        std::string viewText = std::string(argv[1]) + " " + argv[2] + " " + argv[3];
+        if (!ViewState::fromString(viewText, view)) {
+            std::cerr << "Invalid view: " << viewText << std::endl;
+            return -1;
+        }
+        defaultView = view;
+    }
+
     // Initialize GLFW
     if (!glfwInit()) {
         std::cerr << "Failed to initialize GLFW" << std::endl;
@@ -117,12 +570,19 @@ int main() {
     }
 
     // Configure GLFW
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // OpenGL 4.3 for compute shaders
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     // Create window
     GLFWwindow* window = glfwCreateWindow(width, height, "Mandelbrot Explorer", nullptr, nullptr);
+    if (!window) {
+        // e.g. macOS stops at 4.1; texture.frag only needs 3.3
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(width, height, "Mandelbrot Explorer", nullptr, nullptr);
+    }
     if (!window) {
         std::cerr << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -131,6 +591,8 @@ int main() {
     glfwMakeContextCurrent(window);
     glfwSetKeyCallback(window, keyCallback);
     glfwSetScrollCallback(window, scrollCallback);
+    glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+    glfwSetWindowRefreshCallback(window, refreshCallback);
 
     // Initialize GLAD
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
@@ -139,20 +601,58 @@ int main() {
     }
     std::string vertSource = loadShaderFile("shaders/texture.vert");
     std::string fragSource = loadShaderFile("shaders/texture.frag");
+    std::string colorizeSource = loadShaderFile("shaders/colorize.frag");
+    std::string computeSource = loadShaderFile("shaders/mandelbrot.comp");
     
-    if (vertSource.empty() || fragSource.empty()) {
+    if (vertSource.empty() || fragSource.empty() || colorizeSource.empty()) {
         // Handle error (shader failed to load)
         return -1;
     }
     
-    unsigned int vertexShader = compileShader(GL_VERTEX_SHADER, vertSource.c_str());
-    unsigned int fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragSource.c_str());
-    unsigned int shaderProgram = createShaderProgram(vertexShader, fragmentShader);
+    unsigned int shaderProgram = createCachedProgram({{GL_VERTEX_SHADER, vertSource}, {GL_FRAGMENT_SHADER, fragSource}});
+    // second pass, colors the iteration texture
+    unsigned int colorizeProgram = createCachedProgram({{GL_VERTEX_SHADER, vertSource}, {GL_FRAGMENT_SHADER, colorizeSource}});
+    if (!shaderProgram || !colorizeProgram) {
+        return -1;
+    }
+
+    // variant with double-single coordinates, used once float resolution is exhausted
+    unsigned int doubleSingleProgram = createVariantProgram(vertSource, fragSource, "DOUBLE_SINGLE");
+    if (!doubleSingleProgram) {
+        std::cerr << "Double-single shader unavailable, zooms up to 1e10 stay at float precision" << std::endl;
+    }
+    // variant iterating deviations from a reference orbit, used where the CPU renderer perturbs
+    unsigned int perturbationProgram = createVariantProgram(vertSource, fragSource, "PERTURBATION");
+    if (!perturbationProgram) {
+        std::cerr << "Perturbation shader unavailable, deep zooms stay at float precision" << std::endl;
+    }
+
+    // the same variants as compute shaders, 0 where not available
+    unsigned int computePrograms[3] = {};
+    unsigned int counterBuffer = 0;
+    if (GLAD_GL_VERSION_4_3 && !computeSource.empty()) {
+        computePrograms[0] = createComputeProgram(fragSource, computeSource, nullptr);
+        computePrograms[1] = doubleSingleProgram ? createComputeProgram(fragSource, computeSource, "DOUBLE_SINGLE") : 0;
+        computePrograms[2] = perturbationProgram ? createComputeProgram(fragSource, computeSource, "PERTURBATION") : 0;
+        glGenBuffers(1, &counterBuffer);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffer);
+        glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(unsigned int), nullptr, GL_DYNAMIC_READ);
+    }
+    if (!computePrograms[0]) {
+        std::cerr << "Compute shaders unavailable, iterating with texture.frag" << std::endl;
+    }
 
-    GLint zoomLoc = glGetUniformLocation(shaderProgram, "zoom");
-    GLint centerLoc = glGetUniformLocation(shaderProgram, "center");
-    GLint nRepsLoc = glGetUniformLocation(shaderProgram, "maxRepetitions");
-    GLint aspectLoc = glGetUniformLocation(shaderProgram, "aspectRatio");
+    // reference orbit as buffer texture on texture unit 1
+    int maxOrbitLength;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxOrbitLength);
+    maxOrbitLength = std::min(maxOrbitLength, IterationLimitOptions().maxIterations + maxExtraIterations + 2);
+    unsigned int orbitBuffer, orbitTexture;
+    glGenBuffers(1, &orbitBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, orbitBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, 2 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+    glGenTextures(1, &orbitTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, orbitTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, orbitBuffer);
 
     // Set up vertex data and buffers
     float vertices[] = {
@@ -189,22 +689,11 @@ int main() {
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    // Create texture
-    unsigned int texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    // Allocate texture storage
-    const int texWidth = width;
-    const int texHeight = height;
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, texWidth, texHeight, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
-
-    // Set texture parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    // The iteration passes render the values of texture.frag at framebuffer resolution,
+    // the colorize pass reads them. Passes start over when the view, the iteration limit,
+    // smooth coloring or the size change, and continue until all pixels are finished.
+    IterationTargets targets;
+    bool passesPending = false;
 
 
     mat4x4 model, projection;
@@ -213,36 +702,88 @@ int main() {
 
     // Main render loop
     while (!glfwWindowShouldClose(window)) {
+        if (!needsRedraw) {
+            glfwWaitEvents();
+            continue;
+        }
+        needsRedraw = false;
         glfwGetWindowSize(window, &width, &height);
         aspectRatio = width / (float) height;
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        bool restart = viewChanged;
+        if (framebufferWidth != targets.width || framebufferHeight != targets.height) {
+            resizeIterationTargets(targets, framebufferWidth, framebufferHeight);
+            restart = true;
+        }
+        const bool perturbation = perturbationProgram != 0 && needsPerturbation(view);
+        if (viewChanged && perturbation) {
+            updateReferenceOrbit(orbitBuffer, maxOrbitLength);
+        } else if (viewChanged && autoRepetitions) {
+            IterationLimitOptions options;
+            options.maxIterations = interactive_max_iterations;
+            maxRepetitions = chooseIterationLimit(windowDimensions(), options);
+        }
+        viewChanged = false;
+
+        unsigned int program = shaderProgram;
+        unsigned int computeProgram = computePrograms[0];
+        std::string mode = "single precision";
+        if (perturbation) {
+            program = perturbationProgram;
+            computeProgram = computePrograms[2];
+            mode = "perturbation";
+        } else if (doubleSingleProgram != 0 && needsDoubleSingle()) {
+            program = doubleSingleProgram;
+            computeProgram = computePrograms[1];
+            mode = "double-single precision";
+        }
+        const bool singlePrecision = program == shaderProgram;
+        const bool compute = computeProgram != 0 && (computeShaderUse == compute_all_modes
+            || (computeShaderUse == compute_single_precision && singlePrecision));
+        mode += compute ? ", compute shader" : ", fragment shader";
+        if (mode != precisionMode) {
+            std::cout << mode << std::endl;
+            precisionMode = mode;
+        }
 
-        glUniform1f(zoomLoc, zoomFactor);
-        glUniform2f(centerLoc, xCenter, yCenter);
-        glUniform1i(nRepsLoc, maxRepetitions);
-        glUniform1f(aspectLoc, aspectRatio);
-        glUniform1i(glGetUniformLocation(shaderProgram, "colorFuncIndex"), currentFuncIndex);
-        // std::cout << "ZOOM FACTOR " << zoomFactor << "X" << xCenter << "Y" << yCenter << "\n";
-
+        glBindVertexArray(VAO);
+        if (restart || passesPending) {
+            // Iteration pass into the targets
+            if (compute) {
+                program = computeProgram;
+            }
+            glUseProgram(program);
+            setViewUniforms(program);
+            glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, &projection[0][0]);
+            glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, &model[0][0]);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_BUFFER, orbitTexture);
+            glUniform1i(glGetUniformLocation(program, "referenceOrbit"), 1);
+            if (compute) {
+                passesPending = runComputePass(program, targets, counterBuffer, restart);
+            } else {
+                passesPending = runIterationPass(program, targets, restart);
+            }
+            // show the partial result, then continue
+            needsRedraw = needsRedraw || passesPending;
+        }
 
+        glViewport(0, 0, framebufferWidth, framebufferHeight);
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        // Activate shader
-        glUseProgram(shaderProgram);
-        
-        // Set uniforms
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, &projection[0][0]);
-        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, &model[0][0]);
-        
-        // Bind texture
+        // Colorize pass
+        glUseProgram(colorizeProgram);
+        glUniformMatrix4fv(glGetUniformLocation(colorizeProgram, "projection"), 1, GL_FALSE, &projection[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(colorizeProgram, "model"), 1, GL_FALSE, &model[0][0]);
+        glUniform1i(glGetUniformLocation(colorizeProgram, "colorFuncIndex"), currentFuncIndex);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glUniform1i(glGetUniformLocation(shaderProgram, "texture1"), 0);
-        
-        // Draw quad
-        glBindVertexArray(VAO);
+        glBindTexture(GL_TEXTURE_2D, targets.values);
+        glUniform1i(glGetUniformLocation(colorizeProgram, "iterations"), 0);
         glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
+        ++framesRendered;
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
@@ -252,6 +793,24 @@ int main() {
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
     glDeleteProgram(shaderProgram);
+    glDeleteProgram(colorizeProgram);
+    deleteIterationTargets(targets);
+    for (unsigned int computeProgram : computePrograms) {
+        if (computeProgram) {
+            glDeleteProgram(computeProgram);
+        }
+    }
+    if (counterBuffer) {
+        glDeleteBuffers(1, &counterBuffer);
+    }
+    if (doubleSingleProgram) {
+        glDeleteProgram(doubleSingleProgram);
+    }
+    if (perturbationProgram) {
+        glDeleteProgram(perturbationProgram);
+    }
+    glDeleteTextures(1, &orbitTexture);
+    glDeleteBuffers(1, &orbitBuffer);
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Hardware performance counters of Linux (perf_event_open) for the benchmarks and
+ * render --stats. The counters cover the calling thread and all threads it starts
+ * after open(), such as the workers of parallelFor, once they have been joined.
+ * Counters the kernel or hardware does not provide (virtual machines, containers,
+ * perf_event_paranoid) are reported as unavailable instead of failing.
+ */
+
+enum PerfCounter
+{
+    counter_cycles,
+    counter_instructions,
+    counter_branch_misses,
+    counter_cache_misses,
+    counter_count
+};
+
+const char* const perf_counter_names[counter_count] = {"cycles", "instructions", "branch-misses", "cache-misses"};
+
+typedef struct PerfCounts
+{
+    double value[counter_count] = {};
+    bool available[counter_count] = {};
+
+    // instructions per cycle, 0 if not available
+    double ipc() const
+    {
+        return available[counter_cycles] && available[counter_instructions] && value[counter_cycles] > 0
+            ? value[counter_instructions] / value[counter_cycles] : 0.0;
+    }
+
+    /**
+     * @brief
+     * "IPC 2.41, 0.0132 branch-misses, 0.0001 cache-misses per iteration", leaving out
+     * what is not available.
+     *
+     * @param iterations pixel-iterations spent while counting
+     */
+    std::string summary(double iterations) const
+    {
+        std::string text;
+        char part[64];
+        if (ipc() > 0) {
+            snprintf(part, sizeof(part), "IPC %.2f", ipc());
+            text += part;
+        }
+        for (int c : {counter_branch_misses, counter_cache_misses}) {
+            if (!available[c] || iterations <= 0) continue;
+            snprintf(part, sizeof(part), "%s%.4f %s", text.empty() ? "" : ", ", value[c] / iterations,
+                perf_counter_names[c]);
+            text += part;
+        }
+        if (text.empty()) return "no hardware counters available";
+        return text + " per iteration";
+    }
+} PerfCounts;
+
+class PerfCounters
+{
+public:
+    ~PerfCounters()
+    {
+        for (int fd : fds) {
+            if (fd >= 0) ::close(fd);
+        }
+    }
+
+    /**
+     * @brief
+     * Open the counters, stopped.
+     *
+     * @return false if no counter is available; error() tells why
+     */
+    bool open()
+    {
+        const uint64_t configs[counter_count] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+        bool any = false;
+        for (int c = 0; c < counter_count; ++c) {
+            perf_event_attr attributes;
+            memset(&attributes, 0, sizeof(attributes));
+            attributes.size = sizeof(attributes);
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = configs[c];
+            attributes.disabled = 1;
+            attributes.inherit = 1;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            // counters share the hardware with other processes and may run only part of the time
+            attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[c] = (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+            if (fds[c] < 0) {
+                reason = std::string(perf_counter_names[c]) + ": " + strerror(errno);
+            }
+            any = any || fds[c] >= 0;
+        }
+        return any;
+    }
+
+    // why the last counter that could not be opened is unavailable, empty if all are available
+    const std::string& error() const { return reason; }
+
+    void start()
+    {
+        for (int fd : fds) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    /**
+     * @brief
+     * Stop counting and return the counts since start(), scaled up if the kernel
+     * multiplexed the counters.
+     */
+    PerfCounts stop()
+    {
+        PerfCounts counts;
+        for (int c = 0; c < counter_count; ++c) {
+            if (fds[c] < 0) continue;
+            ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t data[3]; // value, time enabled, time running
+            if (::read(fds[c], data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+            counts.value[c] = (double) data[0] * data[1] / data[2];
+            counts.available[c] = true;
+        }
+        return counts;
+    }
+
+private:
+    int fds[counter_count] = {-1, -1, -1, -1};
+    std::string reason;
+};
@@ -1,8 +1,12 @@
+#pragma once
+
 #include <algorithm>
 #include <vector>
 #include <array>
+#include <cmath>
 #include <stdio.h>
 #include <iostream>
+#include <string>
 
 // function mostly written by DeepSeek AI
 void intToInferno(int value, int max_N, float& rr, float& gg, float& bb) {
@@ -15,13 +19,11 @@ void intToInferno(int value, int max_N, float& rr, float& gg, float& bb) {
         rr = 0; gg = 0; bb = 0;
         return;
     } else if (normalized >= 1.0) {
-        rr = 252/255; gg = 255/255, bb = 164.0/255.0;   // Yellow-white at 1.0
-        std::cout << bb << "\n";
+        rr = 252.0/255.0; gg = 255.0/255.0, bb = 164.0/255.0;   // Yellow-white at 1.0
         return;
     }
 
-    std::cout << normalized << " ";
-    
+
     // Key points in the inferno colormap (value, R, G, B)
     std::array<std::array<double, 4>, 9> inferno_points = {{
         {0.0,    0.0,    0.0,    0.0},
@@ -43,8 +45,9 @@ void intToInferno(int value, int max_N, float& rr, float& gg, float& bb) {
             break;
         }
     }
-    if (normalized > inferno_points[inferno_points.size()-2][0]) {
-        segment = inferno_points.size()-1;
+    // the last segment, from the second to last point to the last
+    if (normalized >= inferno_points[inferno_points.size()-2][0]) {
+        segment = inferno_points.size()-2;
     }
     
     // Linear interpolation within the segment
@@ -56,9 +59,7 @@ void intToInferno(int value, int max_N, float& rr, float& gg, float& bb) {
         float channel = inferno_points[segment][i+1] + 
                         t * (inferno_points[segment+1][i+1] - inferno_points[segment][i+1]);
         color[i] = std::round(channel);
-        std::cout << color[i]/256 << " ";
     }
-    std::cout << "\n";
     rr = color[0]/256;
     gg = color[1]/256;
     bb = color[2]/256;
@@ -149,3 +150,59 @@ void intToRainbowRGB(int value, int max_N, float& rr, float& gg, float& bb) {
             break;
     }
 }
+
+typedef void (*ColorFunction)(int value, int max_N, float& rr, float& gg, float& bb);
+
+/**
+ * @brief
+ * Color function for a palette name ("inferno", "rainbow" or "bw").
+ *
+ * @return nullptr for an unknown name
+ */
+ColorFunction colorFunctionByName(const std::string& name)
+{
+    if (name == "inferno") return intToInferno;
+    if (name == "rainbow") return intToRainbowRGB;
+    if (name == "bw") return intToBWRGB;
+    return nullptr;
+}
+
+/**
+ * @brief
+ * Tabulate <colorFunction> for all iteration counts 0 ... nIterations.
+ */
+template <typename Callable>
+void createRGBVectors(int nIterations, 
+    std::vector<float>& r, 
+    std::vector<float>& g, 
+    std::vector<float>& b,
+    Callable colorFunction
+)
+{
+    float rr, gg, bb;
+    for (int i = 0; i <= nIterations; ++i) {
+        colorFunction(i, nIterations, rr, gg, bb);
+        r[i] = rr;
+        g[i] = gg;
+        b[i] = bb;
+    }
+}
+
+/**
+ * @brief
+ * Look up the color of a continuous value in [0, 1] by linear interpolation
+ * between the entries of the color tables.
+ */
+void interpolateRGB(float value,
+    const std::vector<float>& r,
+    const std::vector<float>& g,
+    const std::vector<float>& b,
+    float& rr, float& gg, float& bb)
+{
+    float position = value * (r.size() - 1);
+    size_t lower = std::min((size_t) position, r.size() - 2);
+    float t = position - lower;
+    rr = r[lower] + t * (r[lower+1] - r[lower]);
+    gg = g[lower] + t * (g[lower+1] - g[lower]);
+    bb = b[lower] + t * (b[lower+1] - b[lower]);
+}
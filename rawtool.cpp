@@ -0,0 +1,237 @@
+// Works on raw iteration files written by render --raw: prints their header, recolors
+// them (optionally a crop) into an image, or counts pixels per iteration count,
+// all without iterating again.
+#include "engine.h"
+#include "equalize.h"
+#include "imageio.h"
+#include "iterationfile.h"
+#include "rainbow.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+static void printUsage(const char* program)
+{
+    fprintf(stderr,
+        "Usage: %s info <raw file>\n"
+        "       %s color <raw file> <image> [options]\n"
+        "           --palette <name>           inferno, rainbow or bw (default inferno)\n"
+        "           --smooth                   color by continuous iteration count\n"
+        "           --equalize                 spread the palette evenly over the pixels of the crop\n"
+        "           --crop <x>,<y>,<w>x<h>     only the w x h pixels with top left corner (x, y)\n"
+        "       %s histogram <raw file> [--bins <n>]\n"
+        "           prints pixel counts per iteration count (or per range of n bins) as CSV\n"
+        "  --threads <n> sets the worker threads of any command\n",
+        program, program, program);
+}
+
+static int info(const IterationFile& file)
+{
+    printf("view: %s\n", file.view().toString().c_str());
+    printf("size: %dx%d pixels in %dx%d tiles of %d pixels\n", file.width(), file.height(),
+        file.tileColumns(), file.tileRows(), file.tileSize());
+    printf("iteration limit: %d\n", file.maxIterations());
+    printf("channels: iterations%s%s\n", file.channels() & channel_smooth ? ", smooth" : "",
+        file.channels() & channel_distance ? ", distance" : "");
+    printf("compressed: %s\n", file.header().compressed ? "yes" : "no");
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief
+ * Color the region (left, top, width, height) of <file> row of tiles by row of tiles,
+ * so that memory use does not depend on the image height.
+ *
+ * @param equalize equalize the palette by the escape histogram of the region, which
+ *                 takes one more pass over it
+ */
+static int color(const IterationFile& file, const std::string& output, const std::string& palette, bool smooth,
+    bool equalize, int left, int top, int width, int height)
+{
+    if (smooth && !(file.channels() & channel_smooth)) {
+        fprintf(stderr, "The raw file has no smooth channel\n");
+        return EXIT_FAILURE;
+    }
+    const int nIterations = file.maxIterations();
+    std::vector<float> r(nIterations+1), g(nIterations+1), b(nIterations+1);
+    FrameBuffer frame;
+    if (equalize) {
+        EscapeHistogram escapes;
+        for (int row = top; row < top + height; ) {
+            int rows = std::min(top + height, (row / file.tileSize() + 1) * file.tileSize()) - row;
+            if (!file.readRegion(left, row, width, rows, frame)) {
+                fprintf(stderr, "Failed to read the raw file\n");
+                return EXIT_FAILURE;
+            }
+            countEscapes(frame, nIterations, escapes);
+            row += rows;
+        }
+        createEqualizedRGBVectors(escapes, nIterations, r, g, b, colorFunctionByName(palette));
+    } else {
+        createRGBVectors(nIterations, r, g, b, colorFunctionByName(palette));
+    }
+
+    ImageWriter writer;
+    if (!writer.open(output, width, height)) {
+        fprintf(stderr, "Failed to open %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    std::vector<float> colors;
+    std::vector<uint8_t> pixels;
+    bool ok = true;
+    for (int row = top; row < top + height && ok; ) {
+        // up to the end of the current row of tiles
+        int rows = std::min(top + height, (row / file.tileSize() + 1) * file.tileSize()) - row;
+        ok = file.readRegion(left, row, width, rows, frame);
+        colors.resize(3 * frame.iterations.size());
+        parallelFor(rows, [&](int j) {
+            for (size_t index = (size_t) j * width; index < (size_t) (j + 1) * width; ++index) {
+                float* rgb = &colors[3 * index];
+                if (smooth) {
+                    interpolateRGB(frame.smooth[index], r, g, b, rgb[0], rgb[1], rgb[2]);
+                } else {
+                    int n = std::clamp(frame.iterations[index], 0, nIterations);
+                    rgb[0] = r[n];
+                    rgb[1] = g[n];
+                    rgb[2] = b[n];
+                }
+            }
+        });
+        pixels.resize(colors.size());
+        floatToRGB8(colors.data(), frame.iterations.size(), pixels.data());
+        ok = ok && writer.writeRows(pixels.data(), rows);
+        row += rows;
+    }
+    if (!writer.close() || !ok) {
+        fprintf(stderr, "Failed to write %s\n", output.c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+static int histogram(const IterationFile& file, int bins)
+{
+    const int nIterations = file.maxIterations();
+    std::vector<size_t> counts(nIterations + 1, 0);
+    std::mutex mutex;
+    bool ok = true;
+    // tiles are read in place, one row of tiles per task
+    parallelFor(file.tileRows(), [&](int y) {
+        std::vector<size_t> local(nIterations + 1, 0);
+        std::vector<uint8_t> scratch;
+        bool rowOk = true;
+        const int size = file.tileSize();
+        const int jEnd = std::min(size, file.height() - y * size);
+        for (int x = 0; x < file.tileColumns() && rowOk; ++x) {
+            IterationTile tile;
+            rowOk = file.readTile(x, y, tile, scratch);
+            const int iEnd = std::min(size, file.width() - x * size);
+            for (int j = 0; j < jEnd && rowOk; ++j) {
+                for (int i = 0; i < iEnd; ++i) {
+                    ++local[std::clamp(tile.iterations[(size_t) j * size + i], 0, nIterations)];
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ok = ok && rowOk;
+        for (int n = 0; n <= nIterations; ++n) {
+            counts[n] += local[n];
+        }
+    });
+    if (!ok) {
+        fprintf(stderr, "Corrupt tile data\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t pixels = (size_t) file.width() * file.height();
+    fprintf(stderr, "%zu pixels, %zu inside the set (iteration limit %d)\n", pixels, counts[nIterations], nIterations);
+    // escaped pixels in bins of equal width; the set itself is listed separately
+    bins = bins > 0 ? std::min(bins, nIterations) : nIterations;
+    printf("first,last,count\n");
+    for (int bin = 0; bin < bins; ++bin) {
+        int first = (int) ((long) nIterations * bin / bins);
+        int last = (int) ((long) nIterations * (bin + 1) / bins) - 1;
+        size_t count = 0;
+        for (int n = first; n <= last; ++n) {
+            count += counts[n];
+        }
+        if (count > 0) {
+            printf("%d,%d,%zu\n", first, last, count);
+        }
+    }
+    printf("%d,%d,%zu\n", nIterations, nIterations, counts[nIterations]);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string command = argv[1];
+    IterationFile file;
+    if (!file.open(argv[2])) {
+        return EXIT_FAILURE;
+    }
+
+    std::string output;
+    std::string palette = "inferno";
+    bool smooth = false;
+    bool equalize = false;
+    int bins = 0;
+    int left = 0, top = 0, width = file.width(), height = file.height();
+    int k = 3;
+    if (command == "color") {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        output = argv[k++];
+    }
+    for (; k < argc; ++k) {
+        std::string arg = argv[k];
+        if (k + 1 >= argc && arg != "--smooth" && arg != "--equalize") {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (arg == "--palette") {
+            palette = argv[++k];
+            if (!colorFunctionByName(palette)) {
+                fprintf(stderr, "Unknown palette: %s\n", palette.c_str());
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--smooth") {
+            smooth = true;
+        } else if (arg == "--equalize") {
+            equalize = true;
+        } else if (arg == "--crop") {
+            std::string crop = argv[++k];
+            if (sscanf(crop.c_str(), "%d,%d,%dx%d", &left, &top, &width, &height) != 4 || left < 0 || top < 0
+                || width <= 0 || height <= 0 || left + width > file.width() || top + height > file.height()) {
+                fprintf(stderr, "Invalid crop %s for a %dx%d image\n", crop.c_str(), file.width(), file.height());
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--bins") {
+            bins = atoi(argv[++k]);
+        } else if (arg == "--threads") {
+            engineThreads = atoi(argv[++k]);
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (command == "info") {
+        return info(file);
+    } else if (command == "color") {
+        return color(file, output, palette, smooth, equalize, left, top, width, height);
+    } else if (command == "histogram") {
+        return histogram(file, bins);
+    }
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,1120 @@
+// Headless renderer: computes a view with the multithreaded CPU engine and writes
+// it as an image, without opening a window.
+#include "engine.h"
+#include "animation.h"
+#include "checkpoint.h"
+#include "equalize.h"
+#include "imageio.h"
+#include "iterationfile.h"
+#include "perfcounters.h"
+#include "rainbow.h"
+#include "viewstate.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// at zoom factor 1 the shorter image side spans center +- boundary, as in mandelbrot.cpp
+const double boundary = 1.1;
+// edge length of the tiles of a tile pyramid in pixels
+const int tileSize = 256;
+
+/*
+ * File name pattern of animation frames, such as frame%05d.png: the frame number is
+ * inserted between prefix and suffix, padded to <width> digits (with zeros if zeroPad).
+ */
+typedef struct FramePattern
+{
+    std::string prefix;
+    std::string suffix;
+    bool zeroPad = false;
+    int width = 0;
+} FramePattern;
+
+typedef struct RenderSettings
+{
+    ViewState view;
+    int width = 1920;
+    int height = 1080;
+    int iterations = 0; // 0 for automatic
+    std::string palette = "inferno";
+    bool smooth = false;
+    bool equalize = false; // histogram-equalized palette, see equalize.h
+    int supersample = 0; // samples per boundary pixel, 0 for none
+    int stripHeight = 32; // rows computed and written at a time
+    std::string output = "mandelbrot.png";
+    FramePattern framePattern; // parsed from output for animations
+    std::string tileDirectory; // non-empty to export a tile pyramid instead of one image
+    int levels = 6; // zoom levels of the tile pyramid
+    std::string keyframes; // keyframe file to render an animation instead of one image
+    int videoFrames = 0; // frames of a zoom video from an exponential map, 0 for none
+    double startLogZoom = 0; // log2 zoom of the first frame of a zoom video
+    std::string rawOutput; // raw iteration file, see iterationfile.h
+    bool rawCompress = false;
+    std::string checkpoint; // checkpoint file to resume an interrupted render from
+    double checkpointInterval = 60; // seconds between checkpoints
+    std::string trace; // Chrome trace JSON of the render, see trace.h
+    bool stats = false; // print hardware counters per pixel-iteration and escape statistics
+    std::string histogram; // CSV file of how many pixels escaped at each iteration
+} RenderSettings;
+
+/**
+ * @brief
+ * Parse an --output pattern for animation frames. It must hold exactly one conversion
+ * %d, %<width>d or %0<width>d; %% stands for a literal %, anything else after % is rejected.
+ * The pattern is never used as a printf format, see frameFileName.
+ */
+static bool parseFramePattern(const std::string& pattern, FramePattern& parsed)
+{
+    parsed = FramePattern();
+    bool converted = false;
+    for (size_t k = 0; k < pattern.size(); ++k) {
+        std::string& text = converted ? parsed.suffix : parsed.prefix;
+        if (pattern[k] != '%') {
+            text += pattern[k];
+            continue;
+        }
+        if (++k < pattern.size() && pattern[k] == '%') {
+            text += '%';
+            continue;
+        }
+        if (converted) return false;
+        if (k < pattern.size() && pattern[k] == '0') {
+            parsed.zeroPad = true;
+            ++k;
+        }
+        for (; k < pattern.size() && isdigit((unsigned char) pattern[k]); ++k) {
+            parsed.width = 10 * parsed.width + (pattern[k] - '0');
+            if (parsed.width > 32) return false;
+        }
+        if (k >= pattern.size() || pattern[k] != 'd') return false;
+        converted = true;
+    }
+    return converted;
+}
+
+/**
+ * @brief
+ * File name of animation frame <frame> for the pattern parsed by parseFramePattern.
+ */
+static std::string frameFileName(const FramePattern& pattern, int frame)
+{
+    char number[64];
+    snprintf(number, sizeof(number), pattern.zeroPad ? "%0*d" : "%*d", pattern.width, frame);
+    return pattern.prefix + number + pattern.suffix;
+}
+
+static void printUsage(const char* program)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --view \"<re> <im> <zoom>\"  view as printed by the explorers\n"
+        "  --center <re> <im>         center of the image (default -0.6 0)\n"
+        "  --zoom <zoom>              zoom factor, also 1/<x> or 2^<x> (default 1)\n"
+        "  --size <width>x<height>    image size in pixels (default 1920x1080)\n"
+        "  --iterations <n|auto>      iteration limit (default auto)\n"
+        "  --palette <name>           inferno, rainbow or bw (default inferno)\n"
+        "  --smooth                   color by continuous iteration count\n"
+        "  --equalize                 spread the palette evenly over the pixels (histogram equalization)\n"
+        "  --supersample <n>          anti-alias with n samples per boundary pixel\n"
+        "  --threads <n>              worker threads (default: all hardware threads)\n"
+        "  --strip <rows>             rows per strip; memory use is about 2 strips (default 32)\n"
+        "  --output <file>            .png or .ppm; - writes PPM to stdout (default mandelbrot.png)\n"
+        "  --tiles <directory>        write a pyramid of 256x256 tiles <directory>/z/x/y.png instead\n"
+        "  --levels <n>               zoom levels of the tile pyramid (default 6)\n"
+        "  --keyframes <file>         render the frames of a zoom path, one \"<frame> <re> <im> <zoom> [iterations]\"\n"
+        "                             per line; --output is a pattern such as frame%%05d.png, or - to\n"
+        "                             pipe PPM frames to an encoder\n"
+        "  --zoom-video <frames>      render a zoom video from --start-zoom into the view through one\n"
+        "                             exponential map; --output as for --keyframes\n"
+        "  --start-zoom <zoom>        zoom factor of the first video frame (default 1)\n"
+        "  --raw <file>               also save iterations, smooth and distance channels for rawtool\n"
+        "  --checkpoint <file>        save progress to <file> and resume from it when it exists\n"
+        "  --checkpoint-interval <s>  seconds between checkpoints (default 60)\n"
+        "  --raw-compress             zlib-compress the raw file (smaller, but not memory-mappable)\n"
+        "  --trace <file>             write the spans of strips, tiles and row blocks per thread as\n"
+        "                             Chrome trace JSON (chrome://tracing, ui.perfetto.dev)\n"
+        "  --stats                    print CPU cycles, instructions, branch and cache misses (Linux)\n"
+        "                             and how many pixels escaped by which iteration\n"
+        "  --histogram <file>         write how many pixels escaped at each iteration as CSV\n",
+        program);
+}
+
+/**
+ * @brief
+ * Parse the command line into <settings>.
+ *
+ * @return false (after printing a message) for invalid arguments
+ */
+static bool parseArguments(int argc, char** argv, RenderSettings& settings)
+{
+    std::string re = "-0.6", im = "0", zoom = "1";
+    std::string viewText;
+    for (int k = 1; k < argc; ++k) {
+        std::string arg = argv[k];
+        auto value = [&]() {
+            if (k + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                exit(EXIT_FAILURE);
+            }
+            return std::string(argv[++k]);
+        };
+        if (arg == "--view") {
+            viewText = value();
+        } else if (arg == "--center") {
+            re = value();
+            im = value();
+        } else if (arg == "--zoom") {
+            zoom = value();
+        } else if (arg == "--size") {
+            std::string size = value();
+            if (sscanf(size.c_str(), "%dx%d", &settings.width, &settings.height) != 2
+                || settings.width <= 0 || settings.height <= 0) {
+                fprintf(stderr, "Invalid size: %s\n", size.c_str());
+                return false;
+            }
+        } else if (arg == "--iterations") {
+            std::string n = value();
+            settings.iterations = n == "auto" ? 0 : atoi(n.c_str());
+            if (n != "auto" && settings.iterations <= 0) {
+                fprintf(stderr, "Invalid iteration limit: %s\n", n.c_str());
+                return false;
+            }
+        } else if (arg == "--palette") {
+            settings.palette = value();
+            if (!colorFunctionByName(settings.palette)) {
+                fprintf(stderr, "Unknown palette: %s\n", settings.palette.c_str());
+                return false;
+            }
+        } else if (arg == "--smooth") {
+            settings.smooth = true;
+        } else if (arg == "--equalize") {
+            settings.equalize = true;
+        } else if (arg == "--supersample") {
+            std::string n = value();
+            char* end;
+            long samples = strtol(n.c_str(), &end, 10);
+            if (n.empty() || *end != '\0' || samples < 0 || samples > INT_MAX) {
+                fprintf(stderr, "Invalid number of samples: %s\n", n.c_str());
+                return false;
+            }
+            settings.supersample = (int) samples;
+        } else if (arg == "--strip") {
+            settings.stripHeight = std::max(1, atoi(value().c_str()));
+        } else if (arg == "--threads") {
+            engineThreads = atoi(value().c_str());
+        } else if (arg == "--output" || arg == "-o") {
+            settings.output = value();
+        } else if (arg == "--keyframes") {
+            settings.keyframes = value();
+        } else if (arg == "--zoom-video") {
+            settings.videoFrames = atoi(value().c_str());
+            if (settings.videoFrames < 2) {
+                fprintf(stderr, "A zoom video needs at least 2 frames\n");
+                return false;
+            }
+        } else if (arg == "--start-zoom") {
+            ViewState start;
+            std::string startZoom = value();
+            if (!ViewState::fromString("0 0 " + startZoom, start)) {
+                fprintf(stderr, "Invalid zoom: %s\n", startZoom.c_str());
+                return false;
+            }
+            settings.startLogZoom = start.logZoom;
+        } else if (arg == "--raw") {
+            settings.rawOutput = value();
+        } else if (arg == "--checkpoint") {
+            settings.checkpoint = value();
+        } else if (arg == "--checkpoint-interval") {
+            settings.checkpointInterval = atof(value().c_str());
+        } else if (arg == "--stats") {
+            settings.stats = true;
+        } else if (arg == "--histogram") {
+            settings.histogram = value();
+        } else if (arg == "--trace") {
+            settings.trace = value();
+        } else if (arg == "--raw-compress") {
+            settings.rawCompress = true;
+        } else if (arg == "--tiles") {
+            settings.tileDirectory = value();
+        } else if (arg == "--levels") {
+            settings.levels = atoi(value().c_str());
+            // pixel indices of the deepest level must fit into an int
+            if (settings.levels < 1 || settings.levels > 22) {
+                fprintf(stderr, "Invalid number of levels: %d\n", settings.levels);
+                return false;
+            }
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (!settings.rawOutput.empty() && !settings.tileDirectory.empty()) {
+        fprintf(stderr, "--raw cannot be combined with --tiles\n");
+        return false;
+    }
+    if (!settings.checkpoint.empty()
+        && (!settings.tileDirectory.empty() || !settings.keyframes.empty() || settings.videoFrames > 0)) {
+        // tile pyramids resume from the tiles already written
+        fprintf(stderr, "--checkpoint only applies to single images\n");
+        return false;
+    }
+    if (!settings.histogram.empty() && (!settings.tileDirectory.empty() || !settings.keyframes.empty()
+        || settings.videoFrames > 0 || !settings.checkpoint.empty())) {
+        // tiles share pixels with their parents, and resumed strips are not iterated again
+        fprintf(stderr, "--histogram only applies to single images without --checkpoint\n");
+        return false;
+    }
+    if (!settings.keyframes.empty() || settings.videoFrames > 0) {
+        if (!settings.tileDirectory.empty() || !settings.rawOutput.empty()
+            || (!settings.keyframes.empty() && settings.videoFrames > 0)) {
+            fprintf(stderr, "--keyframes, --zoom-video, --tiles and --raw cannot be combined\n");
+            return false;
+        }
+        if (settings.output != "-" && !parseFramePattern(settings.output, settings.framePattern)) {
+            fprintf(stderr, "Animations need an --output pattern with one %%d, %%<width>d or %%0<width>d "
+                "(%%%% for a literal %%) such as frame%%05d.png, or -\n");
+            return false;
+        }
+    }
+    if (viewText.empty()) {
+        viewText = re + " " + im + " " + zoom;
+    }
+    if (!ViewState::fromString(viewText, settings.view)) {
+        fprintf(stderr, "Invalid view: %s\n", viewText.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ * Everything needed to compute and color any part of the image.
+ */
+typedef struct RenderJob
+{
+    SampleDimensions dimensions;
+    ReferenceOrbit reference;
+    bool perturbation = false;
+    int nIterations = 0;
+    std::vector<float> r, g, b;
+
+    const ReferenceOrbit* referencePointer() const { return perturbation ? &reference : nullptr; }
+} RenderJob;
+
+/**
+ * @brief
+ * Color tables of the job. Strips are colored before the whole image is known, so with
+ * --equalize the histogram comes from a preview of the view at a quarter of the resolution.
+ */
+static void createColors(const RenderSettings& settings, RenderJob& job)
+{
+    if (settings.equalize) {
+        const int previewWidth = std::max(1, (settings.tileDirectory.empty() ? settings.width : tileSize) / 4);
+        const int previewHeight = std::max(1, (settings.tileDirectory.empty() ? settings.height : tileSize) / 4);
+        SampleDimensions preview = createImageDimensions(settings.view, boundary, previewWidth, previewHeight);
+        FrameBuffer frame;
+        EscapeHistogram histogram;
+        renderFrame(preview, previewWidth, previewHeight, job.nIterations, frame, false, job.referencePointer(),
+            &histogram);
+        createEqualizedRGBVectors(histogram, job.nIterations, job.r, job.g, job.b,
+            colorFunctionByName(settings.palette));
+        return;
+    }
+    job.r.resize(job.nIterations+1);
+    job.g.resize(job.nIterations+1);
+    job.b.resize(job.nIterations+1);
+    createRGBVectors(job.nIterations, job.r, job.g, job.b, colorFunctionByName(settings.palette));
+}
+
+static RenderJob prepareJob(const RenderSettings& settings)
+{
+    RenderJob job;
+    const ViewState& view = settings.view;
+    if (settings.tileDirectory.empty()) {
+        job.dimensions = createImageDimensions(view, boundary, settings.width, settings.height);
+    } else {
+        // level 0 of the pyramid is a single tile covering center +- boundary
+        job.dimensions = createImageDimensions(view, boundary, tileSize, tileSize);
+    }
+    job.perturbation = needsPerturbation(view);
+    IterationLimitOptions limitOptions;
+    if (job.perturbation) {
+        job.reference = computeReferenceOrbit(view, 2);
+    }
+    job.nIterations = settings.iterations;
+    if (job.nIterations == 0) {
+        // the reference orbit grows with the rounds, so it is only as long as the chosen limit needs
+        job.nIterations = chooseIterationLimit(job.dimensions, limitOptions, job.referencePointer(), [&](int limit) {
+            if (job.perturbation) {
+                extendReferenceOrbit(view, job.reference, limit + maxExtraIterations + 2);
+            }
+        });
+    }
+    if (job.perturbation) {
+        extendReferenceOrbit(view, job.reference, job.nIterations + maxExtraIterations + 2);
+    }
+    createColors(settings, job);
+    return job;
+}
+
+/**
+ * @brief
+ * Like prepareJob, but with the iteration limit and reference orbit from the checkpoint
+ * file if it exists; otherwise the checkpoint file is created.
+ *
+ * @return false (after printing a message) if the checkpoint file cannot be used
+ */
+static bool prepareCheckpointedJob(const RenderSettings& settings, RenderJob& job, Checkpoint& checkpoint)
+{
+    // everything that determines the pixels, so that only the same render is resumed
+    std::ostringstream description;
+    description << settings.view.toString() << "\n" << settings.width << "x" << settings.height
+        << " iterations " << settings.iterations << " palette " << settings.palette << " smooth " << settings.smooth
+        << " equalize " << settings.equalize << " supersample " << settings.supersample << " raw " << !settings.rawOutput.empty() << "\n";
+    if (!std::filesystem::exists(settings.checkpoint)) {
+        job = prepareJob(settings);
+        if (!checkpoint.create(settings.checkpoint, description.str(), job.nIterations, job.reference,
+                job.perturbation)) {
+            fprintf(stderr, "Failed to create %s\n", settings.checkpoint.c_str());
+            return false;
+        }
+        return true;
+    }
+    job.dimensions = createImageDimensions(settings.view, boundary, settings.width, settings.height);
+    if (!checkpoint.resume(settings.checkpoint, description.str(), job.nIterations, job.reference,
+            job.perturbation)) {
+        return false;
+    }
+    createColors(settings, job);
+    fprintf(stderr, "resuming from %s at row %d\n", settings.checkpoint.c_str(), checkpoint.completedRows());
+    return true;
+}
+
+/**
+ * @brief
+ * Color of a sample with <n> iterations and continuous iteration count <smooth>.
+ */
+static void colorSample(const RenderSettings& settings, const RenderJob& job, int n, float smooth,
+    float& rr, float& gg, float& bb)
+{
+    if (settings.smooth) {
+        interpolateRGB(smooth, job.r, job.g, job.b, rr, gg, bb);
+    } else {
+        rr = job.r[n];
+        gg = job.g[n];
+        bb = job.b[n];
+    }
+}
+
+/**
+ * @brief
+ * Color the rows rowBegin ... rowEnd-1 of <frame>, supersampling them if requested.
+ *
+ * @param dimensions sample positions <frame> was computed with
+ * @param colors receives 3 floats per pixel of <frame>
+ * @return number of supersampled pixels
+ */
+static size_t colorFrame(const RenderSettings& settings, const RenderJob& job, const SampleDimensions& dimensions,
+    const FrameBuffer& frame, std::vector<float>& colors, int rowBegin, int rowEnd)
+{
+    auto colorize = [&](int n, float smooth, float& rr, float& gg, float& bb) {
+        colorSample(settings, job, n, smooth, rr, gg, bb);
+    };
+    const int width = frame.width;
+    colors.resize(3 * frame.iterations.size());
+    parallelFor(rowEnd - rowBegin, [&](int row) {
+        size_t j = rowBegin + row;
+        for (size_t index = j * width; index < (j + 1) * width; ++index) {
+            float smooth = settings.smooth ? frame.smooth[index] : 0.0f;
+            colorize(frame.iterations[index], smooth, colors[3*index], colors[3*index+1], colors[3*index+2]);
+        }
+    });
+    if (settings.supersample <= 0) {
+        return 0;
+    }
+    SupersampleOptions options;
+    options.maxSamples = settings.supersample;
+    return supersampleFrame(dimensions, job.nIterations, frame, options, colorize, colors,
+        job.referencePointer(), rowBegin, rowEnd);
+}
+
+/**
+ * @brief
+ * Compute and color the rows firstRow ... firstRow+rows-1 of the image.
+ *
+ * @param frame, colors work buffers, reused between strips
+ * @param pixels receives rows x width 8-bit RGB pixels
+ * @param supersampled incremented by the number of supersampled pixels
+ * @param raw if not nullptr, receives the escape-time data of the rows
+ * @param checkpoint if not nullptr, receives the pixels (and escape-time data with raw) of the rows
+ * @param histogram if not nullptr, the escape iterations of the rows are added to it
+ * @return number of iterations spent
+ */
+static double renderStrip(const RenderSettings& settings, const RenderJob& job, int firstRow, int rows,
+    FrameBuffer& frame, std::vector<float>& colors, std::vector<uint8_t>& pixels, size_t& supersampled,
+    IterationFileWriter* raw, Checkpoint* checkpoint, EscapeHistogram* histogram)
+{
+    const int width = settings.width;
+    const bool details = settings.smooth || settings.supersample > 0 || !settings.rawOutput.empty();
+    // with supersampling, one more row on either side tells which pixels border the set
+    const int halo = settings.supersample > 0 ? 1 : 0;
+    const int top = std::max(0, firstRow - halo);
+    const int bottom = std::min(settings.height, firstRow + rows + halo);
+    TraceSpan span("strip", 0, firstRow);
+
+    SampleDimensions strip = job.dimensions;
+    strip.firstRow = top;
+    renderFrame(strip, width, bottom - top, job.nIterations, frame, details, job.referencePointer(), histogram);
+    if (histogram) {
+        // the halo rows belong to the neighbouring strips
+        for (int j = 0; j < frame.height; ++j) {
+            if (j >= firstRow - top && j < firstRow - top + rows) continue;
+            for (int i = 0; i < width; ++i) {
+                int n = frame.iterations[(size_t) j*width + i];
+                if (n < job.nIterations) {
+                    --histogram->counts[n];
+                } else {
+                    --histogram->interior;
+                }
+            }
+        }
+    }
+
+    supersampled += colorFrame(settings, job, strip, frame, colors, firstRow - top, firstRow - top + rows);
+
+    pixels.resize(3 * (size_t) width * rows);
+    floatToRGB8(colors.data() + 3 * (size_t) width * (firstRow - top), (size_t) width * rows, pixels.data());
+    if (raw) {
+        raw->writeRows(frame, firstRow - top, rows);
+    }
+    if (checkpoint) {
+        checkpoint->appendStrip(width, firstRow, rows, pixels, raw ? &frame : nullptr, firstRow - top);
+    }
+
+    double iterations = 0;
+    for (int n : frame.iterations) {
+        iterations += std::min(n + 1, job.nIterations);
+    }
+    span.setIterations((int64_t) iterations);
+    return iterations;
+}
+
+// progress of a tile pyramid export
+typedef struct TileExport
+{
+    size_t written = 0;
+    size_t skipped = 0;
+    size_t reused = 0; // pixels copied from the parent tile
+    size_t supersampled = 0;
+    double iterations = 0;
+    bool ok = true;
+    std::deque<std::future<bool>> pending; // tiles being compressed and written
+} TileExport;
+
+static std::string tilePath(const std::string& directory, int z, int x, int y)
+{
+    return directory + "/" + std::to_string(z) + "/" + std::to_string(x) + "/" + std::to_string(y) + ".png";
+}
+
+/**
+ * @brief
+ * Write tile (x, y) of zoom level z and, depth first, all tiles below it.
+ *
+ * Level z splits the square center +- boundary into 2^z x 2^z tiles, with tile (0, 0)
+ * at the top left. Pixels are sampled at their top left corner, so the even pixels
+ * of a tile are exactly the samples of its parent tile and are copied from it.
+ * Tiles whose file exists are kept, so an interrupted export resumes where it stopped.
+ *
+ * @param parent the computed parent tile, nullptr if it was not computed
+ */
+static void exportTile(const RenderSettings& settings, const RenderJob& job, TileExport& progress,
+    int z, int x, int y, const FrameBuffer* parent)
+{
+    std::string path = tilePath(settings.tileDirectory, z, x, y);
+    bool exists = std::filesystem::exists(path);
+    FrameBuffer frame;
+    if (exists) {
+        ++progress.skipped;
+    } else {
+        TraceSpan span("tile", x, y);
+        SampleDimensions tile = job.dimensions;
+        tile.dx = std::ldexp(job.dimensions.dx, -z);
+        tile.dy = std::ldexp(job.dimensions.dy, -z);
+        tile.firstColumn = x * tileSize;
+        tile.firstRow = y * tileSize;
+
+        const bool details = settings.smooth || settings.supersample > 0;
+        frame.width = tileSize;
+        frame.height = tileSize;
+        frame.iterations.resize(tileSize * tileSize);
+        frame.smooth.resize(details ? frame.iterations.size() : 0);
+        frame.distance.resize(details ? frame.iterations.size() : 0);
+        // offset of this tile's quarter in the parent tile
+        const int parentColumn = (x % 2) * tileSize / 2;
+        const int parentRow = (y % 2) * tileSize / 2;
+        std::vector<double> rowIterations(tileSize);
+        parallelFor(tileSize, [&](int j) {
+            TraceSpan rowSpan("tile row", tile.firstColumn, tile.firstRow + j);
+            for (int i = 0; i < tileSize; ++i) {
+                size_t index = (size_t) j * tileSize + i;
+                if (parent && i % 2 == 0 && j % 2 == 0) {
+                    size_t source = (size_t) (parentRow + j / 2) * tileSize + parentColumn + i / 2;
+                    frame.iterations[index] = parent->iterations[source];
+                    if (details) {
+                        frame.smooth[index] = parent->smooth[source];
+                        // the same distance covers twice as many of the smaller pixels
+                        frame.distance[index] = 2 * parent->distance[source];
+                    }
+                    continue;
+                }
+                if (details) {
+                    frame.iterations[index] = iteratePixel(tile, job.referencePointer(), i, j, job.nIterations,
+                        &frame.smooth[index], &frame.distance[index]);
+                    frame.distance[index] /= tile.dx;
+                } else {
+                    frame.iterations[index] = iteratePixel(tile, job.referencePointer(), i, j, job.nIterations);
+                }
+                rowIterations[j] += std::min(frame.iterations[index] + 1, job.nIterations);
+            }
+            rowSpan.setIterations((int64_t) rowIterations[j]);
+        });
+        double tileIterations = 0;
+        for (double n : rowIterations) {
+            tileIterations += n;
+        }
+        progress.iterations += tileIterations;
+        span.setIterations((int64_t) tileIterations);
+        if (parent) {
+            progress.reused += tileSize * tileSize / 4;
+        }
+
+        std::vector<float> colors;
+        progress.supersampled += colorFrame(settings, job, tile, frame, colors, 0, tileSize);
+        std::vector<uint8_t> pixels(colors.size());
+        floatToRGB8(colors.data(), frame.iterations.size(), pixels.data());
+
+        // keep a few tiles in flight, the next tile is computed while they are written
+        const size_t maxPending = std::max(2u, std::thread::hardware_concurrency());
+        while (progress.pending.size() >= maxPending) {
+            progress.ok = progress.pending.front().get() && progress.ok;
+            progress.pending.pop_front();
+        }
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+        // written under a temporary name, so that a file with the tile's name is always complete
+        progress.pending.push_back(std::async(std::launch::async, [path, x, y, pixels = std::move(pixels)]() {
+            TraceSpan span("write tile", x, y);
+            std::string temporary = path + ".part";
+            if (!writeImage(temporary, tileSize, tileSize, pixels.data())) {
+                fprintf(stderr, "Failed to write %s\n", temporary.c_str());
+                return false;
+            }
+            return rename(temporary.c_str(), path.c_str()) == 0;
+        }));
+        ++progress.written;
+    }
+
+    if (z + 1 < settings.levels) {
+        for (int child = 0; child < 4; ++child) {
+            exportTile(settings, job, progress, z + 1, 2*x + child % 2, 2*y + child / 2, exists ? nullptr : &frame);
+        }
+    }
+}
+
+/**
+ * @brief
+ * Export the tile pyramid of settings.view to settings.tileDirectory.
+ *
+ * @return false if tiles could not be written, or the directory holds tiles of different settings
+ */
+static bool exportTiles(const RenderSettings& settings, const RenderJob& job, TileExport& progress)
+{
+    // tiles are only resumed or extended with more levels if they were rendered with the same settings
+    std::ostringstream description;
+    description << settings.view.toString() << "\n"
+        << "iterations " << job.nIterations << " palette " << settings.palette
+        << " smooth " << settings.smooth << " supersample " << settings.supersample
+        << (settings.equalize ? " equalize" : "") << "\n";
+    std::string descriptionPath = settings.tileDirectory + "/view.txt";
+    std::ifstream existing(descriptionPath);
+    if (existing) {
+        std::stringstream previous;
+        previous << existing.rdbuf();
+        if (previous.str() != description.str()) {
+            fprintf(stderr, "%s holds tiles of different settings:\n%s", settings.tileDirectory.c_str(),
+                previous.str().c_str());
+            return false;
+        }
+    } else {
+        std::error_code error;
+        std::filesystem::create_directories(settings.tileDirectory, error);
+        std::ofstream(descriptionPath) << description.str();
+    }
+
+    exportTile(settings, job, progress, 0, 0, 0, nullptr);
+    for (auto& pending : progress.pending) {
+        progress.ok = pending.get() && progress.ok;
+    }
+    return progress.ok;
+}
+
+// set by SIGINT and SIGTERM while a checkpointed render runs
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+/**
+ * @brief
+ * Render the image of <job> to <output>, strip by strip.
+ *
+ * @param iterations, supersampled incremented by the iterations spent and the number of supersampled pixels
+ * @param checkpoint if not nullptr, the strips it holds are written first, and new strips are
+ *                   added to it every settings.checkpointInterval seconds and when stopped by a signal
+ * @param histogram if not nullptr, the escape iterations of the strips computed are added to it
+ * @return false (after printing a message) if the image could not be written or the render was stopped
+ */
+static bool renderImage(const RenderSettings& settings, const RenderJob& job, const std::string& output,
+    double& iterations, size_t& supersampled, Checkpoint* checkpoint = nullptr, EscapeHistogram* histogram = nullptr)
+{
+    ImageWriter writer;
+    if (!writer.open(output, settings.width, settings.height)) {
+        fprintf(stderr, "Failed to open %s\n", output.c_str());
+        return false;
+    }
+    IterationFileWriter raw;
+    if (!settings.rawOutput.empty()
+        && !raw.open(settings.rawOutput, settings.width, settings.height,
+            channel_iterations | channel_smooth | channel_distance, job.nIterations, settings.view,
+            settings.rawCompress)) {
+        fprintf(stderr, "Failed to open %s\n", settings.rawOutput.c_str());
+        return false;
+    }
+    // two sets of strip buffers: one strip is computed while the previous one is compressed and written
+    FrameBuffer frame;
+    std::vector<float> colors;
+    std::vector<uint8_t> pixels[2];
+    std::future<bool> pending;
+    bool ok = true;
+    int resumeRow = 0;
+    if (checkpoint) {
+        // the finished strips are copied from the checkpoint into the new image
+        int firstRow, rows;
+        while (ok && checkpoint->readStrip(settings.width, settings.height, firstRow, rows, pixels[0],
+                settings.rawOutput.empty() ? nullptr : &frame)) {
+            ok = writer.writeRows(pixels[0].data(), rows);
+            if (!settings.rawOutput.empty()) {
+                raw.writeRows(frame, 0, rows);
+            }
+            resumeRow = firstRow + rows;
+        }
+        if (!ok || resumeRow != checkpoint->completedRows() || !checkpoint->startAppending()) {
+            fprintf(stderr, "Failed to read %s\n", settings.checkpoint.c_str());
+            return false;
+        }
+    }
+    auto lastCheckpoint = std::chrono::steady_clock::now();
+    for (int firstRow = resumeRow, k = 0; firstRow < settings.height && ok; firstRow += settings.stripHeight, ++k) {
+        int rows = std::min(settings.stripHeight, settings.height - firstRow);
+        std::vector<uint8_t>& stripPixels = pixels[k % 2];
+        iterations += renderStrip(settings, job, firstRow, rows, frame, colors, stripPixels, supersampled,
+            settings.rawOutput.empty() ? nullptr : &raw, checkpoint, histogram);
+        if (checkpoint) {
+            auto now = std::chrono::steady_clock::now();
+            if (stopRequested || std::chrono::duration<double>(now - lastCheckpoint).count() >= settings.checkpointInterval) {
+                if (!checkpoint->commit()) {
+                    fprintf(stderr, "Failed to write %s\n", settings.checkpoint.c_str());
+                    ok = false;
+                }
+                lastCheckpoint = now;
+            }
+            if (stopRequested) {
+                fprintf(stderr, "stopped after row %d; run the same command again to resume\n", firstRow + rows);
+                ok = false;
+            }
+        }
+        if (pending.valid()) {
+            ok = pending.get() && ok;
+        }
+        pending = std::async(std::launch::async, [&writer, &stripPixels, rows]() {
+            return writer.writeRows(stripPixels.data(), rows);
+        });
+    }
+    if (pending.valid()) {
+        ok = pending.get() && ok;
+    }
+    if (stopRequested) {
+        return false;
+    }
+    if (!writer.close() || !ok) {
+        fprintf(stderr, "Failed to write %s\n", output.c_str());
+        return false;
+    }
+    if (!settings.rawOutput.empty() && !raw.close()) {
+        fprintf(stderr, "Failed to write %s\n", settings.rawOutput.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief
+ * Render every frame of the zoom path in settings.keyframes.
+ * The view, reference orbit and iteration limit of the next frame are prepared while
+ * the current frame is rendered.
+ */
+static bool renderAnimation(const RenderSettings& settings, double& iterations, size_t& supersampled)
+{
+    std::vector<Keyframe> keyframes;
+    if (!readKeyframes(settings.keyframes, keyframes)) {
+        return false;
+    }
+    ZoomPath path(keyframes);
+    auto prepareFrame = [&settings, &path](int frame) {
+        RenderSettings frameSettings = settings;
+        frameSettings.view = path.viewAt(frame, frameSettings.iterations);
+        return prepareJob(frameSettings);
+    };
+    std::future<RenderJob> next = std::async(std::launch::async, prepareFrame, path.firstFrame());
+    for (int frame = path.firstFrame(); frame <= path.lastFrame(); ++frame) {
+        RenderJob job = next.get();
+        if (frame < path.lastFrame()) {
+            next = std::async(std::launch::async, prepareFrame, frame + 1);
+        }
+        std::string output = settings.output;
+        if (output != "-") {
+            output = frameFileName(settings.framePattern, frame);
+        }
+        if (!renderImage(settings, job, output, iterations, supersampled)) {
+            if (next.valid()) next.wait();
+            return false;
+        }
+        fprintf(stderr, "frame %d of %d: %d iterations%s\n", frame, path.lastFrame(), job.nIterations,
+            job.perturbation ? " (perturbation)" : "");
+    }
+    return true;
+}
+
+/**
+ * @brief
+ * Colors of the plane around the view center in log-polar coordinates: column c is
+ * the angle 2 pi (c + 0.5) / width, counterclockwise from the positive real axis, and
+ * row k the radius exp(logOuterRadius - 2 pi k / width), so that samples are square.
+ */
+typedef struct ExponentialMap
+{
+    int width = 0;
+    int height = 0;
+    double logOuterRadius = 0;
+    std::vector<uint8_t> rgb;
+} ExponentialMap;
+
+/**
+ * @brief
+ * Compute the exponential map around settings.view covering every frame of a zoom
+ * video from settings.startLogZoom to the view's zoom: from the corners of the first
+ * frame inwards to half a pixel of the last frame.
+ */
+static ExponentialMap renderExponentialMap(const RenderSettings& settings, const RenderJob& job, double& iterations)
+{
+    ExponentialMap map;
+    const double halfDiagonal = 0.5 * std::hypot(settings.width, settings.height);
+    // angular resolution of the frame corners
+    map.width = (int) std::ceil(2 * M_PI * halfDiagonal);
+    const double step = 2 * M_PI / map.width;
+    // natural logarithm of the pixel spacing at zoom factor 1
+    const double logSpacing = std::log(2 * boundary / std::min(settings.width, settings.height));
+    map.logOuterRadius = logSpacing - settings.startLogZoom * M_LN2 + std::log(halfDiagonal);
+    const double logInnerRadius = logSpacing - settings.view.logZoom * M_LN2 + std::log(0.5);
+    map.height = std::max(1, (int) std::ceil((map.logOuterRadius - logInnerRadius) / step) + 1);
+    map.rgb.resize(3 * (size_t) map.width * map.height);
+
+    const double real_0 = settings.view.real.toDouble();
+    const double imaginary_0 = settings.view.imaginary.toDouble();
+    std::vector<double> rowIterations(map.height);
+    parallelFor(map.height, [&](int k) {
+        const double radius = std::exp(map.logOuterRadius - k * step);
+        for (int c = 0; c < map.width; ++c) {
+            const double angle = (c + 0.5) * step;
+            const double dx = radius * std::cos(angle);
+            const double dy = radius * std::sin(angle);
+            float smooth = 0.0f;
+            float* smoothPointer = settings.smooth ? &smooth : nullptr;
+            int n = job.perturbation
+                ? iteratePerturbed(job.reference, dx, dy, job.nIterations, smoothPointer)
+                : iterateMandelbrot(real_0 + dx, imaginary_0 + dy, job.nIterations, smoothPointer);
+            float rgb[3];
+            colorSample(settings, job, n, smooth, rgb[0], rgb[1], rgb[2]);
+            floatToRGB8(rgb, 1, &map.rgb[3 * ((size_t) k * map.width + c)]);
+            rowIterations[k] += std::min(n + 1, job.nIterations);
+        }
+    });
+    for (double n : rowIterations) {
+        iterations += n;
+    }
+    return map;
+}
+
+/**
+ * @brief
+ * Resample frame <frame> of the zoom video from <map>, bilinearly.
+ *
+ * @param pixels receives width x height 8-bit RGB pixels
+ */
+static void resampleFrame(const RenderSettings& settings, const ExponentialMap& map, int frame,
+    std::vector<uint8_t>& pixels)
+{
+    const int width = settings.width, height = settings.height;
+    const double logZoom = settings.startLogZoom
+        + (settings.view.logZoom - settings.startLogZoom) * frame / (settings.videoFrames - 1);
+    const double logSpacing = std::log(2 * boundary / std::min(width, height)) - logZoom * M_LN2;
+    const double scale = map.width / (2 * M_PI);
+    pixels.resize(3 * (size_t) width * height);
+    parallelFor(height, [&](int y) {
+        for (int x = 0; x < width; ++x) {
+            // offset from the center in pixels; image rows run downwards
+            const double dx = x + 0.5 - 0.5 * width;
+            const double dy = 0.5 * height - (y + 0.5);
+            double angle = std::atan2(dy, dx);
+            if (angle < 0) angle += 2 * M_PI;
+            const double column = angle * scale - 0.5;
+            const double logRadius = logSpacing + 0.5 * std::log(dx*dx + dy*dy);
+            const double row = std::clamp((map.logOuterRadius - logRadius) * scale, 0.0, map.height - 1.0);
+            const int c0 = (int) std::floor(column);
+            const int k0 = std::max(0, std::min((int) row, map.height - 2));
+            const double tc = column - c0, tk = std::min(1.0, row - k0);
+            // columns wrap around the circle
+            const int c1 = (c0 + 1 + map.width) % map.width;
+            const int cc = (c0 + map.width) % map.width;
+            const int k1 = std::min(k0 + 1, map.height - 1);
+            for (int channel = 0; channel < 3; ++channel) {
+                auto at = [&](int k, int c) { return (double) map.rgb[3 * ((size_t) k * map.width + c) + channel]; };
+                double top = at(k0, cc) + tc * (at(k0, c1) - at(k0, cc));
+                double bottom = at(k1, cc) + tc * (at(k1, c1) - at(k1, cc));
+                pixels[3 * ((size_t) y * width + x) + channel] = (uint8_t) (top + tk * (bottom - top) + 0.5);
+            }
+        }
+    });
+}
+
+/**
+ * @brief
+ * Render a zoom video of settings.videoFrames frames, zooming exponentially from
+ * settings.startLogZoom into settings.view. All samples come from one exponential map,
+ * so the video costs about as much as ln(zoom ratio) * pi/2 * diagonal^2 samples
+ * instead of frames * width * height.
+ */
+static bool renderZoomVideo(const RenderSettings& settings, double& iterations)
+{
+    // one iteration limit for the whole video, chosen for the deepest frame
+    RenderJob job = prepareJob(settings);
+    ExponentialMap map = renderExponentialMap(settings, job, iterations);
+    fprintf(stderr, "exponential map: %dx%d samples, %d iterations%s\n", map.width, map.height, job.nIterations,
+        job.perturbation ? " (perturbation)" : "");
+
+    // one frame is resampled while the previous one is compressed and written
+    std::vector<uint8_t> pixels[2];
+    std::future<bool> pending;
+    bool ok = true;
+    for (int frame = 0; frame < settings.videoFrames && ok; ++frame) {
+        std::vector<uint8_t>& framePixels = pixels[frame % 2];
+        resampleFrame(settings, map, frame, framePixels);
+        if (pending.valid()) {
+            ok = pending.get();
+        }
+        std::string output = settings.output;
+        if (output != "-") {
+            output = frameFileName(settings.framePattern, frame);
+        }
+        pending = std::async(std::launch::async, [&settings, &framePixels, output]() {
+            if (writeImage(output, settings.width, settings.height, framePixels.data())) return true;
+            fprintf(stderr, "Failed to write %s\n", output.c_str());
+            return false;
+        });
+    }
+    if (pending.valid()) {
+        ok = pending.get() && ok;
+    }
+    return ok;
+}
+
+/**
+ * @brief
+ * Write <histogram> as CSV: one line "<iteration>,<pixels>" per iteration at which pixels
+ * escaped, and a last line with the iteration limit and the pixels that did not escape.
+ */
+static bool writeHistogram(const std::string& path, const EscapeHistogram& histogram, int maxIterations)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "iterations,pixels\n");
+    for (size_t n = 0; n < histogram.counts.size(); ++n) {
+        if (histogram.counts[n] > 0) {
+            fprintf(file, "%zu,%llu\n", n, (unsigned long long) histogram.counts[n]);
+        }
+    }
+    fprintf(file, "%d,%llu\n", maxIterations, (unsigned long long) histogram.interior);
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+/**
+ * @brief
+ * Print the share of pixels that escaped and by which iteration most of them had.
+ */
+static void printEscapeStats(const EscapeHistogram& histogram)
+{
+    const uint64_t exterior = histogram.exterior();
+    const uint64_t total = exterior + histogram.interior;
+    fprintf(stderr, "%llu pixels escaped (%.2f%%), %llu did not",
+        (unsigned long long) exterior, total ? 100.0 * exterior / total : 0.0,
+        (unsigned long long) histogram.interior);
+    if (exterior > 0) {
+        fprintf(stderr, "; 50%%, 99%%, 99.9%% of them by iteration %d, %d, %d", histogram.percentile(0.5),
+            histogram.percentile(0.99), histogram.percentile(0.999));
+    }
+    fprintf(stderr, "\n");
+}
+
+/**
+ * @brief
+ * With --stats, print the counters since the start of the render, which includes
+ * coloring and writing the output.
+ *
+ * @param iterations pixel-iterations spent by the render
+ */
+static void printStats(const RenderSettings& settings, PerfCounters& counters, double iterations)
+{
+    if (!settings.stats) return;
+    PerfCounts counts = counters.stop();
+    for (int c = 0; c < counter_count; ++c) {
+        if (counts.available[c]) {
+            fprintf(stderr, "%s %.4g, ", perf_counter_names[c], counts.value[c]);
+        }
+    }
+    fprintf(stderr, "%s\n", counts.summary(iterations).c_str());
+}
+
+int main(int argc, char** argv)
+{
+    RenderSettings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        return EXIT_FAILURE;
+    }
+    // written on every return from main
+    struct TraceWriter
+    {
+        std::string path;
+        ~TraceWriter()
+        {
+            if (path.empty()) return;
+            traceEnabled = false;
+            if (!writeTrace(path)) {
+                fprintf(stderr, "Failed to write %s\n", path.c_str());
+            }
+        }
+    } traceWriter = {settings.trace};
+    if (!settings.trace.empty()) {
+        startTrace();
+    }
+    PerfCounters counters;
+    if (settings.stats) {
+        if (!counters.open()) {
+            fprintf(stderr, "Hardware counters unavailable (%s)\n", counters.error().c_str());
+        }
+        counters.start();
+    }
+    auto start = std::chrono::steady_clock::now();
+    double iterations = 0;
+    size_t supersampled = 0;
+    if (!settings.keyframes.empty()) {
+        if (!renderAnimation(settings, iterations, supersampled)) {
+            return EXIT_FAILURE;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "%dx%d pixels per frame, %zu pixels supersampled\n",
+            settings.width, settings.height, supersampled);
+        fprintf(stderr, "wall time %.3f s, %.1f Mpixel-iterations/s\n", seconds, iterations / seconds / 1e6);
+        printStats(settings, counters, iterations);
+        return EXIT_SUCCESS;
+    }
+    if (settings.videoFrames > 0) {
+        if (!renderZoomVideo(settings, iterations)) {
+            return EXIT_FAILURE;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "%d frames of %dx%d pixels\n", settings.videoFrames, settings.width, settings.height);
+        fprintf(stderr, "wall time %.3f s, %.1f Mpixel-iterations/s\n", seconds, iterations / seconds / 1e6);
+        printStats(settings, counters, iterations);
+        return EXIT_SUCCESS;
+    }
+    RenderJob job;
+    Checkpoint checkpoint;
+    if (settings.checkpoint.empty()) {
+        job = prepareJob(settings);
+    } else if (!prepareCheckpointedJob(settings, job, checkpoint)) {
+        return EXIT_FAILURE;
+    }
+
+    if (!settings.tileDirectory.empty()) {
+        TileExport progress;
+        if (!exportTiles(settings, job, progress)) {
+            return EXIT_FAILURE;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "view: %s\n", settings.view.toString().c_str());
+        fprintf(stderr, "%d levels, %zu tiles written, %zu already present, %d iterations%s\n",
+            settings.levels, progress.written, progress.skipped, job.nIterations,
+            job.perturbation ? " (perturbation)" : "");
+        fprintf(stderr, "%zu pixels copied from parent tiles, %zu pixels supersampled\n",
+            progress.reused, progress.supersampled);
+        fprintf(stderr, "wall time %.3f s, %.1f Mpixel-iterations/s\n", seconds, progress.iterations / seconds / 1e6);
+        printStats(settings, counters, progress.iterations);
+        return EXIT_SUCCESS;
+    }
+
+    EscapeHistogram histogram;
+    const bool escapes = settings.checkpoint.empty() && (settings.stats || !settings.histogram.empty());
+    if (!settings.checkpoint.empty()) {
+        signal(SIGINT, requestStop);
+        signal(SIGTERM, requestStop);
+        if (!renderImage(settings, job, settings.output, iterations, supersampled, &checkpoint)) {
+            return EXIT_FAILURE;
+        }
+        checkpoint.remove();
+    } else if (!renderImage(settings, job, settings.output, iterations, supersampled, nullptr,
+            escapes ? &histogram : nullptr)) {
+        return EXIT_FAILURE;
+    }
+    if (!settings.histogram.empty() && !writeHistogram(settings.histogram, histogram, job.nIterations)) {
+        fprintf(stderr, "Failed to write %s\n", settings.histogram.c_str());
+        return EXIT_FAILURE;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "view: %s\n", settings.view.toString().c_str());
+    fprintf(stderr, "%dx%d pixels, %d iterations%s, %zu pixels supersampled\n",
+        settings.width, settings.height, job.nIterations, job.perturbation ? " (perturbation)" : "", supersampled);
+    fprintf(stderr, "wall time %.3f s, %.1f Mpixel-iterations/s\n", seconds, iterations / seconds / 1e6);
+    printStats(settings, counters, iterations);
+    if (settings.stats && escapes) {
+        printEscapeStats(histogram);
+    }
+    return EXIT_SUCCESS;
+}
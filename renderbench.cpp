@@ -0,0 +1,234 @@
+// End-to-end benchmark: renders a fixed set of scenes headless, at a fixed size and
+// iteration limit, and writes wall times, thread utilization and a checksum of the
+// iteration counts as JSON, so runs on different commits can be compared. Where hardware
+// counters are available, instructions per cycle and misses per iteration are included.
+#include "engine.h"
+#include "perfcounters.h"
+#include "viewstate.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// at zoom factor 1 the shorter image side spans center +- boundary, as in render.cpp
+const double boundary = 1.1;
+
+typedef struct Scene
+{
+    const char* name;
+    const char* view;
+    int iterations;
+} Scene;
+
+// the views of mandelbrot.cpp plus deeper ones that need perturbation
+const Scene scenes[] = {
+    {"home", "-0.6 0 1", 500},
+    {"bulb", "-1.21235 0.318563 1/0.0190757", 2000},
+    {"bulb-deep", "-1.21235 0.318989 1/1.41981e-05", 5000},
+    {"antenna", "-1.21235 0.17145 21.1809", 1000},
+    {"seahorse-1e9", "-0.743643887037158704752191506114774 0.131825904205311970493132056385139 1e9", 5000},
+    {"seahorse-1e14", "-0.743643887037158704752191506114774 0.131825904205311970493132056385139 1e14", 10000},
+};
+
+typedef struct BenchmarkSettings
+{
+    int width = 1280;
+    int height = 720;
+    int repetitions = 3;
+    bool details = false; // also compute smooth and distance channels
+    std::string only; // only scenes whose name contains this
+    std::string label; // e.g. the commit, copied into the JSON
+    std::string output = "-";
+} BenchmarkSettings;
+
+typedef struct SceneResult
+{
+    const Scene* scene;
+    bool perturbation = false;
+    double setupSeconds = 0; // reference orbit
+    std::vector<double> seconds; // per repetition, sorted
+    double iterations = 0;
+    std::vector<double> utilization; // busy time / wall time per worker, summed over repetitions
+    uint64_t checksum = 0;
+    PerfCounts counts; // over all timed repetitions
+} SceneResult;
+
+static void printUsage(const char* program)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --size <width>x<height>  image size (default 1280x720)\n"
+        "  --repetitions <n>        timed renders per scene (default 3)\n"
+        "  --details                also compute the smooth and distance channels\n"
+        "  --threads <n>            worker threads (default: all hardware threads)\n"
+        "  --scene <name>           only scenes whose name contains <name>\n"
+        "  --label <text>           label of the run in the JSON, e.g. the commit\n"
+        "  --output <file>          JSON file (default: stdout)\n",
+        program);
+}
+
+// FNV-1a over the iteration counts, row by row
+static uint64_t checksum(const std::vector<int>& iterations)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int n : iterations) {
+        for (int byte = 0; byte < 4; ++byte) {
+            hash ^= (uint32_t) n >> (8 * byte) & 0xff;
+            hash *= 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+static SceneResult runScene(const BenchmarkSettings& settings, const Scene& scene, PerfCounters& counters)
+{
+    SceneResult result;
+    result.scene = &scene;
+    ViewState view;
+    ViewState::fromString(scene.view, view);
+    SampleDimensions dimensions = createImageDimensions(view, boundary, settings.width, settings.height);
+    result.perturbation = needsPerturbation(view);
+    ReferenceOrbit reference;
+    auto start = std::chrono::steady_clock::now();
+    if (result.perturbation) {
+        reference = computeReferenceOrbit(view, scene.iterations + maxExtraIterations + 2);
+    }
+    result.setupSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FrameBuffer frame;
+    std::vector<double> busySeconds;
+    // warm-up render, which also gives the checksum
+    renderFrame(dimensions, settings.width, settings.height, scene.iterations, frame, settings.details,
+        result.perturbation ? &reference : nullptr);
+    result.checksum = checksum(frame.iterations);
+    for (int n : frame.iterations) {
+        result.iterations += std::min(n + 1, scene.iterations);
+    }
+
+    double totalSeconds = 0;
+    workerBusySeconds = &busySeconds;
+    counters.start();
+    for (int r = 0; r < settings.repetitions; ++r) {
+        start = std::chrono::steady_clock::now();
+        renderFrame(dimensions, settings.width, settings.height, scene.iterations, frame, settings.details,
+            result.perturbation ? &reference : nullptr);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.seconds.push_back(seconds);
+        totalSeconds += seconds;
+    }
+    result.counts = counters.stop();
+    workerBusySeconds = nullptr;
+    for (double busy : busySeconds) {
+        result.utilization.push_back(busy / totalSeconds);
+    }
+    std::sort(result.seconds.begin(), result.seconds.end());
+    return result;
+}
+
+static void writeJSON(FILE* file, const BenchmarkSettings& settings, const std::vector<SceneResult>& results)
+{
+    int threads = engineThreads > 0 ? engineThreads : (int) std::thread::hardware_concurrency();
+    fprintf(file, "{\n  \"label\": \"%s\",\n  \"width\": %d,\n  \"height\": %d,\n  \"details\": %s,\n"
+        "  \"threads\": %d,\n  \"scenes\": [\n", settings.label.c_str(), settings.width, settings.height,
+        settings.details ? "true" : "false", threads);
+    for (size_t k = 0; k < results.size(); ++k) {
+        const SceneResult& result = results[k];
+        const double median = result.seconds[result.seconds.size() / 2];
+        fprintf(file, "    {\n      \"name\": \"%s\",\n      \"view\": \"%s\",\n      \"iterations\": %d,\n",
+            result.scene->name, result.scene->view, result.scene->iterations);
+        fprintf(file, "      \"perturbation\": %s,\n      \"setup_seconds\": %.6f,\n",
+            result.perturbation ? "true" : "false", result.setupSeconds);
+        fprintf(file, "      \"seconds\": [");
+        for (size_t r = 0; r < result.seconds.size(); ++r) {
+            fprintf(file, "%s%.6f", r ? ", " : "", result.seconds[r]);
+        }
+        fprintf(file, "],\n      \"median_seconds\": %.6f,\n      \"min_seconds\": %.6f,\n", median,
+            result.seconds.front());
+        fprintf(file, "      \"mpixel_iterations_per_second\": %.3f,\n", result.iterations / median / 1e6);
+        fprintf(file, "      \"thread_utilization\": [");
+        for (size_t t = 0; t < result.utilization.size(); ++t) {
+            fprintf(file, "%s%.4f", t ? ", " : "", result.utilization[t]);
+        }
+        fprintf(file, "],\n      \"counters\": {");
+        const double iterations = result.iterations * result.seconds.size();
+        const char* const keys[counter_count] = {"cycles", "instructions", "branch_misses", "cache_misses"};
+        const char* separator = "";
+        for (int c = 0; c < counter_count; ++c) {
+            if (!result.counts.available[c]) continue;
+            fprintf(file, "%s\"%s\": %.0f, \"%s_per_iteration\": %.6f", separator, keys[c],
+                result.counts.value[c], keys[c], result.counts.value[c] / iterations);
+            separator = ", ";
+        }
+        if (result.counts.ipc() > 0) {
+            fprintf(file, "%s\"ipc\": %.4f", separator, result.counts.ipc());
+        }
+        fprintf(file, "},\n      \"checksum\": \"%016llx\"\n    }%s\n", (unsigned long long) result.checksum,
+            k + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkSettings settings;
+    for (int k = 1; k < argc; ++k) {
+        std::string arg = argv[k];
+        if (arg == "--details") {
+            settings.details = true;
+            continue;
+        }
+        if (k + 1 >= argc) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (arg == "--size") {
+            if (sscanf(argv[++k], "%dx%d", &settings.width, &settings.height) != 2
+                || settings.width <= 0 || settings.height <= 0) {
+                fprintf(stderr, "Invalid size: %s\n", argv[k]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--repetitions") {
+            settings.repetitions = std::max(1, atoi(argv[++k]));
+        } else if (arg == "--threads") {
+            engineThreads = atoi(argv[++k]);
+        } else if (arg == "--scene") {
+            settings.only = argv[++k];
+        } else if (arg == "--label") {
+            settings.label = argv[++k];
+        } else if (arg == "--output") {
+            settings.output = argv[++k];
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    PerfCounters counters;
+    if (!counters.open()) {
+        fprintf(stderr, "Hardware counters unavailable (%s)\n", counters.error().c_str());
+    }
+    std::vector<SceneResult> results;
+    for (const Scene& scene : scenes) {
+        if (std::string(scene.name).find(settings.only) == std::string::npos) continue;
+        results.push_back(runScene(settings, scene, counters));
+        const SceneResult& result = results.back();
+        const double median = result.seconds[result.seconds.size() / 2];
+        fprintf(stderr, "%-14s %8.3f s %10.1f Mpixel-iterations/s  checksum %016llx%s\n", scene.name, median,
+            result.iterations / median / 1e6, (unsigned long long) result.checksum,
+            result.perturbation ? "  (perturbation)" : "");
+    }
+
+    FILE* file = settings.output == "-" ? stdout : fopen(settings.output.c_str(), "w");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", settings.output.c_str());
+        return EXIT_FAILURE;
+    }
+    writeJSON(file, settings, results);
+    if (file != stdout && fclose(file) != 0) {
+        fprintf(stderr, "Failed to write %s\n", settings.output.c_str());
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
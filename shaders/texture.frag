@@ -1,111 +1,342 @@
 #version 330 core
+#ifdef DOUBLE_SINGLE
+// without precise, compilers may simplify (a + b) - a to b and drop the rounding errors
+// that double-single arithmetic keeps; precise is core from GLSL 4.00 on
+#if __VERSION__ < 400
+#ifdef GL_ARB_gpu_shader5
+#extension GL_ARB_gpu_shader5 : enable
+#else
+#error double-single arithmetic needs precise from GL_ARB_gpu_shader5
+#endif
+#endif
+#endif
+// With COMPUTE defined, this file only provides the kernels and continuePixel to
+// mandelbrot.comp (see createComputeProgram in newmandelbrot.cpp).
+#ifndef COMPUTE
 in vec2 TexCoord;
-out vec4 FragColor;
+// iterations / maxRepetitions (or the continuous count with smoothColoring), colored by colorize.frag
+layout(location = 0) out float FragValue;
+// Iteration state for progressive rendering: newmandelbrot.cpp runs this shader in passes of a
+// few iterations, each reading the state of the previous pass and writing the next one.
+// State0 holds z (float: z, 0, 0; double-single: re hi, re lo, im hi, im lo; perturbation:
+// deviation, 0, 0), State1 the derivative, the iterations done and the reference orbit index.
+// Finished pixels have State1.z = -1 and keep FragValue, the continuous iteration count /
+// maxRepetitions and the exterior distance estimate in pixels in State0.
+layout(location = 1) out vec4 State0;
+layout(location = 2) out vec4 State1;
+uniform sampler2D state0;
+uniform sampler2D state1;
+uniform int passEnd = 2147483647; // iteration at which this pass stops
+#endif
+uniform bool firstPass = true; // start from z_1 = c instead of reading the state
 uniform float aspectRatio = 1.0f; // dummy value
 uniform float zoom = 1.0;     // Zoom factor
-uniform vec2 center = vec2(0.5); // Pan center
+uniform vec2 center = vec2(0.5); // Window center in the complex plane
+#ifdef DOUBLE_SINGLE
+// Window center as unevaluated sums hi + lo of two floats, for zooms beyond float resolution.
+// newmandelbrot.cpp compiles this variant by defining DOUBLE_SINGLE after the #version line.
+uniform vec2 centerHi = vec2(0.5);
+uniform vec2 centerLo = vec2(0.0);
+#endif
+#ifdef PERTURBATION
+// Reference orbit Z_n of the window center (re, im per texel), computed by newmandelbrot.cpp at the
+// full precision of the view. Pixels are iterated as float deviations from it, for zooms beyond
+// double-single precision.
+uniform samplerBuffer referenceOrbit;
+uniform int referenceLength = 2;
+#endif
 uniform int maxRepetitions = 10;
+uniform bool smoothColoring = false;
 const float convergence_radius_squared = 4.0f;
-
-vec3 hsv2rgb(float h, float s, float v) {
-    vec3 c = vec3(h, s, v);
-    vec3 rgb = clamp(abs(mod(c.x*6.0 + vec3(0.0,4.0,2.0), 6.0)-3.0)-1.0, 0.0, 1.0);
-    return v * mix(vec3(1.0), rgb, c.y);
-}
-
-vec3 hsv2hsv(float h, float s, float v) {
-    return vec3(h,s,v);
-}
+// the smooth iteration count and distance estimate need |z| well beyond 2
+const float smooth_radius_squared = 1e6;
+const int maxExtraIterations = 8;
 
 /**
  * @brief
  * For a complex number c = a + bi, count how many iterations it takes
  * until the magnitude of z_n = z^2_n-1 + c is larger than 2. 
  * The result is divided by maxRepetitions.
+ *
+ * If <details> is set, the derivative dz_n/dc is carried along and escaped points
+ * are iterated a few more times to also obtain the continuous iteration count
+ * (divided by maxRepetitions) and the exterior distance estimate (in units of
+ * the complex plane). Points that do not escape get 1.0 and 0.0.
+ *
+ * The iteration can be split into passes: z, dz and i hold the state (z_1 = c, 1, 0 at
+ * the start), and a pass stops at iteration <end> with a negative result if the point
+ * has neither escaped nor reached maxRepetitions.
  * 
  * @param uv real and imaginary value of input complex number
  * @param maxIterations after how many interations to stop
  */
-float iterateMandelbrot(vec2 uv, int maxRepetitions) {
+float iterateMandelbrot(vec2 uv, inout vec2 z, inout vec2 dz, inout int i, int end, int maxRepetitions, bool details,
+    out float smoothValue, out float distance) {
     float a = uv.x;
     float b = uv.y;
-    float tmp_a = uv.x;
-    float tmp_b = uv.y;
-    for (int i = 0; i < maxRepetitions; ++i) {
+    float tmp_a = z.x;
+    float tmp_b = z.y;
+    smoothValue = 1.0;
+    distance = 0.0;
+    for (; i < min(end, maxRepetitions); ++i) {
         float original_a = tmp_a;
         float original_b = tmp_b;
+        if (details) {
+            dz = 2.0 * vec2(original_a*dz.x - original_b*dz.y, original_a*dz.y + original_b*dz.x) + vec2(1.0, 0.0);
+        }
         tmp_a = original_a*original_a - original_b*original_b + a;
         tmp_b = 2*original_a*original_b + b;
         if (tmp_a*tmp_a + tmp_b*tmp_b > convergence_radius_squared) {
+            if (details) {
+                int n = i;
+                while (n < i + maxExtraIterations && tmp_a*tmp_a + tmp_b*tmp_b < smooth_radius_squared) {
+                    original_a = tmp_a;
+                    original_b = tmp_b;
+                    dz = 2.0 * vec2(original_a*dz.x - original_b*dz.y, original_a*dz.y + original_b*dz.x) + vec2(1.0, 0.0);
+                    tmp_a = original_a*original_a - original_b*original_b + a;
+                    tmp_b = 2*original_a*original_b + b;
+                    ++n;
+                }
+                float abs_z = length(vec2(tmp_a, tmp_b));
+                float log_z = log(abs_z);
+                smoothValue = clamp((float(n) + 1.0 - log2(log_z)) / maxRepetitions, 0.0, 1.0);
+                distance = 0.5 * abs_z * log_z / length(dz);
+            }
             return float(i) / maxRepetitions;
         }
     }
-    return 1.0;
+    z = vec2(tmp_a, tmp_b);
+    return i < maxRepetitions ? -1.0 : 1.0;
+}
+
+#ifdef DOUBLE_SINGLE
+// double-single arithmetic: a value is x + y of two floats with |y| <= ulp(x) / 2,
+// about 48 bits of mantissa; GLSL 3.30 has no fma, so products are split (Dekker)
+
+vec2 dsQuickTwoSum(float a, float b) {
+    precise float s = a + b;
+    precise float e = b - (s - a);
+    return vec2(s, e);
+}
+
+vec2 dsTwoSum(float a, float b) {
+    precise float s = a + b;
+    precise float v = s - a;
+    precise float e = (a - (s - v)) + (b - v);
+    return vec2(s, e);
+}
+
+vec2 dsSplit(float a) {
+    const float split = 4097.0; // 2^12 + 1
+    precise float t = split * a;
+    precise float hi = t - (t - a);
+    precise float lo = a - hi;
+    return vec2(hi, lo);
 }
 
-vec3 iterationsToRainbow (float mb) {
-    return hsv2rgb(mb,1.0,0.9);
+vec2 dsTwoProduct(float a, float b) {
+    precise float p = a * b;
+    vec2 as = dsSplit(a);
+    vec2 bs = dsSplit(b);
+    precise float e = ((as.x*bs.x - p) + as.x*bs.y + as.y*bs.x) + as.y*bs.y;
+    return vec2(p, e);
 }
 
-vec3 iterationsToInvertedRainbow (float mb) {
-    return hsv2rgb(1-mb,1.0,0.9);
+vec2 dsAdd(vec2 a, vec2 b) {
+    vec2 s = dsTwoSum(a.x, b.x);
+    return dsQuickTwoSum(s.x, s.y + a.y + b.y);
 }
 
-// function mostly written by DeepSeek AI
-vec3 iterationsToInferno(float mb) {
-    // Clamp the value between 0 and 1
-    mb = clamp(mb, 0.0, 1.0);
-    
-    // Key points in the inferno colormap (mb, R, G, B)
-    // Note: GLSL doesn't support 2D arrays like C++, so we'll use separate arrays
-    const float positions[9] = float[9](
-        0.0, 0.13, 0.25, 0.38, 0.5, 0.63, 0.75, 0.88, 1.00
-    );
-    
-    const vec3 colors[9] = vec3[9](
-        vec3(0.0, 0.0, 0.0) / 255.0,
-        vec3(27.0, 11.0, 120.0) / 255.0,
-        vec3(81.0, 18.0, 123.0) / 255.0,
-        vec3(134.0, 22.0, 110.0) / 255.0,
-        vec3(185.0, 39.0, 88.0) / 255.0,
-        vec3(225.0, 69.0, 41.0) / 255.0,
-        vec3(243.0, 114.0, 22.0) / 255.0,
-        vec3(252.0, 193.0, 50.0) / 255.0,
-        vec3(252.0, 255.0, 164.0) / 255.0
-    );
-    
-    // Find the interval where the value lies
-    for (int i = 0; i < 8; i++) {
-        if (mb >= positions[i] && mb <= positions[i+1]) {
-            // Linear interpolation between the two colors
-            float t = (mb - positions[i]) / (positions[i+1] - positions[i]);
-            return mix(colors[i], colors[i+1], t);
+vec2 dsMul(vec2 a, vec2 b) {
+    vec2 p = dsTwoProduct(a.x, b.x);
+    return dsQuickTwoSum(p.x, p.y + (a.x*b.y + a.y*b.x));
+}
+
+/**
+ * @brief
+ * Same as iterateMandelbrot for c = ca + cb i given in double-single precision.
+ * Only z is iterated in double-single; the escape test, the derivative and the extra
+ * iterations after escaping only need float precision and use the high parts.
+ * Starts with za = ca, zb = cb.
+ */
+float iterateMandelbrotDS(vec2 ca, vec2 cb, inout vec2 za, inout vec2 zb, inout vec2 dz, inout int i, int end,
+    int maxRepetitions, bool details, out float smoothValue, out float distance) {
+    smoothValue = 1.0;
+    distance = 0.0;
+    for (; i < min(end, maxRepetitions); ++i) {
+        if (details) {
+            dz = 2.0 * vec2(za.x*dz.x - zb.x*dz.y, za.x*dz.y + zb.x*dz.x) + vec2(1.0, 0.0);
+        }
+        vec2 ab = dsMul(za, zb);
+        za = dsAdd(dsAdd(dsMul(za, za), -dsMul(zb, zb)), ca);
+        zb = dsAdd(2.0 * ab, cb);
+        if (za.x*za.x + zb.x*zb.x > convergence_radius_squared) {
+            if (details) {
+                float tmp_a = za.x;
+                float tmp_b = zb.x;
+                int n = i;
+                while (n < i + maxExtraIterations && tmp_a*tmp_a + tmp_b*tmp_b < smooth_radius_squared) {
+                    float original_a = tmp_a;
+                    float original_b = tmp_b;
+                    dz = 2.0 * vec2(original_a*dz.x - original_b*dz.y, original_a*dz.y + original_b*dz.x) + vec2(1.0, 0.0);
+                    tmp_a = original_a*original_a - original_b*original_b + ca.x;
+                    tmp_b = 2*original_a*original_b + cb.x;
+                    ++n;
+                }
+                float abs_z = length(vec2(tmp_a, tmp_b));
+                float log_z = log(abs_z);
+                smoothValue = clamp((float(n) + 1.0 - log2(log_z)) / maxRepetitions, 0.0, 1.0);
+                distance = 0.5 * abs_z * log_z / length(dz);
+            }
+            return float(i) / maxRepetitions;
         }
     }
-    
-    // Fallback (shouldn't be reached if value is properly clamped)
-    return colors[8];
+    return i < maxRepetitions ? -1.0 : 1.0;
 }
+#endif
 
-vec3 iterationsToInvertedInferno(float mb) { return iterationsToInferno(1-mb); }
+#ifdef PERTURBATION
+// move the deviation dz onto the start of the reference orbit when z = Z_m + dz gets
+// closer to 0 than dz itself, or when the orbit ends (see iteratePerturbed in engine.h)
+void perturbedRebase(inout int m, inout vec2 dz, vec2 z) {
+    if (m == referenceLength - 1 || dot(z, z) < dot(dz, dz)) {
+        dz = z;
+        m = 0;
+    }
+}
 
+// dz_m+1 = (2 Z_m + dz_m) dz_m + dc, and the derivative of z = Z_m + dz_m
+void perturbedStep(inout int m, inout vec2 dz, inout vec2 z, inout vec2 derivative, vec2 dc, bool details) {
+    if (details) {
+        derivative = 2.0 * vec2(z.x*derivative.x - z.y*derivative.y, z.x*derivative.y + z.y*derivative.x) + vec2(1.0, 0.0);
+    }
+    vec2 t = 2.0 * texelFetch(referenceOrbit, m).rg + dz;
+    dz = vec2(t.x*dz.x - t.y*dz.y, t.x*dz.y + t.y*dz.x) + dc;
+    ++m;
+    z = texelFetch(referenceOrbit, m).rg + dz;
+}
 
-uniform int colorFuncIndex;
+/**
+ * @brief
+ * Same as iterateMandelbrot for c = C + dc, where C is the point of referenceOrbit.
+ * Only the deviation from the reference orbit is iterated, so float suffices as long
+ * as dc itself is a normal float (zooms up to about 1e30).
+ *
+ * Starts with dz = dc and m = 1; rebasing again at the start of a pass changes nothing.
+ *
+ * @param dc offset of c from the reference point
+ */
+float iterateMandelbrotPerturbed(vec2 dc, inout vec2 dz, inout int m, inout vec2 derivative, inout int i, int end,
+    int maxRepetitions, bool details, out float smoothValue, out float distance) {
+    vec2 z = texelFetch(referenceOrbit, m).rg + dz;
+    smoothValue = 1.0;
+    distance = 0.0;
+    perturbedRebase(m, dz, z);
+    for (; i < min(end, maxRepetitions); ++i) {
+        perturbedStep(m, dz, z, derivative, dc, details);
+        if (dot(z, z) > convergence_radius_squared) {
+            if (details) {
+                int n = i;
+                while (n < i + maxExtraIterations && dot(z, z) < smooth_radius_squared) {
+                    perturbedRebase(m, dz, z);
+                    perturbedStep(m, dz, z, derivative, dc, details);
+                    ++n;
+                }
+                float abs_z = length(z);
+                float log_z = log(abs_z);
+                smoothValue = clamp((float(n) + 1.0 - log2(log_z)) / maxRepetitions, 0.0, 1.0);
+                distance = 0.5 * abs_z * log_z / length(derivative);
+            }
+            return float(i) / maxRepetitions;
+        }
+        perturbedRebase(m, dz, z);
+    }
+    return i < maxRepetitions ? -1.0 : 1.0;
+}
+#endif
+
+
+// offset of the pixel at <texCoord> from the window center
+vec2 centerOffset(vec2 texCoord) {
+    vec2 ndc = (texCoord * 2.0 - 1.0);// * vec2(aspectRatio, 1.0); // normalized coordinates [-1,1]
+    ndc /= zoom;
+    return ndc * vec2(aspectRatio, 1.0) * 0.5;
+}
 
+// state of the pixel at <texCoord> before the first iteration
+void initialState(vec2 texCoord, out vec4 s0, out vec4 s1) {
+    vec2 uv = centerOffset(texCoord);
+#ifdef DOUBLE_SINGLE
+    s0 = vec4(dsAdd(vec2(centerHi.x, centerLo.x), vec2(uv.x, 0.0)), dsAdd(vec2(centerHi.y, centerLo.y), vec2(uv.y, 0.0)));
+#elif defined(PERTURBATION)
+    s0 = vec4(uv, 0.0, 0.0);
+#else
+    s0 = vec4(uv + center, 0.0, 0.0);
+#endif
+    s1 = vec4(1.0, 0.0, 0.0, 1.0);
+}
+
+/**
+ * @brief
+ * Continue the unfinished pixel at <texCoord> from state s0, s1 (see State0 and State1)
+ * up to iteration <end>. Finished pixels get State1.w = 1 if they escaped, 0 if not.
+ *
+ * @param pixelSize width of a pixel in the complex plane, for the distance estimate in pixels
+ * @return whether the pixel is finished
+ */
+bool continuePixel(vec2 texCoord, float pixelSize, inout vec4 s0, inout vec4 s1, int end) {
+    vec2 uv = centerOffset(texCoord);
+    float smoothValue, distance;
+    vec2 derivative = s1.xy;
+    int i = int(s1.z);
+#ifdef DOUBLE_SINGLE
+    vec2 ca = dsAdd(vec2(centerHi.x, centerLo.x), vec2(uv.x, 0.0));
+    vec2 cb = dsAdd(vec2(centerHi.y, centerLo.y), vec2(uv.y, 0.0));
+    vec2 za = s0.xy;
+    vec2 zb = s0.zw;
+    float mb = iterateMandelbrotDS(ca, cb, za, zb, derivative, i, end, maxRepetitions, smoothColoring, smoothValue, distance);
+    s0 = vec4(za, zb);
+#elif defined(PERTURBATION)
+    vec2 dz = s0.xy;
+    int m = int(s1.w);
+    float mb = iterateMandelbrotPerturbed(uv, dz, m, derivative, i, end, maxRepetitions, smoothColoring, smoothValue, distance);
+    s0 = vec4(dz, 0.0, 0.0);
+    s1.w = float(m);
+#else
+    vec2 z = s0.xy;
+    float mb = iterateMandelbrot(uv + center, z, derivative, i, end, maxRepetitions, smoothColoring, smoothValue, distance); // * 255;
+    s0 = vec4(z, 0.0, 0.0);
+#endif
+    if (mb < 0.0) {
+        s1 = vec4(derivative, float(i), s1.w);
+        return false;
+    }
+    bool escaped = i < maxRepetitions;
+    if (smoothColoring) {
+        mb = smoothValue;
+    }
+    s0 = vec4(mb, smoothValue, distance / pixelSize, 0.0);
+    s1 = vec4(0.0, 0.0, -1.0, escaped ? 1.0 : 0.0);
+    return true;
+}
+
+#ifndef COMPUTE
 void main()
 {
-    vec2 ndc = (TexCoord * 2.0 - 1.0);// * vec2(aspectRatio, 1.0); // normalized coordinates [-1,1]
-    ndc /= zoom;
-    vec2 uv = ndc * vec2(aspectRatio, 1.0) * 0.5 + 0.5 + center;
-    float mb = iterateMandelbrot(uv, maxRepetitions); // * 255;
-    vec3 color;
-    switch (colorFuncIndex) {
-        case 0: color = iterationsToRainbow(mb); break;
-        case 1: color = iterationsToInvertedRainbow(mb); break;
-        case 2: color = iterationsToInferno(mb); break;
-        case 3: color = iterationsToInvertedInferno(mb); break;
-        default: color = iterationsToRainbow(mb);
+    // outside of the branches below, where derivatives are undefined
+    float pixelSize = abs(dFdx(TexCoord.x)) * aspectRatio / zoom;
+    vec4 s0, s1;
+    if (firstPass) {
+        initialState(TexCoord, s0, s1);
+    } else {
+        s0 = texelFetch(state0, ivec2(gl_FragCoord.xy), 0);
+        s1 = texelFetch(state1, ivec2(gl_FragCoord.xy), 0);
     }
-    // vec3 color = colorFuncs[colorFuncIndex](mb);
-    FragColor = vec4(color, 1.0);
-}
\ No newline at end of file
+    // pixels finished in an earlier pass keep their state
+    bool finished = s1.z < 0.0 || continuePixel(TexCoord, pixelSize, s0, s1, passEnd);
+    State0 = s0;
+    State1 = s1;
+    // pixels still iterating are shown as inside the set until they escape
+    FragValue = finished ? s0.x : 1.0;
+}
+#endif
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Recording of timed spans (tiles, strips, reference orbits, ...) for chrome://tracing
+ * or Perfetto. Every thread writes into its own ring buffer without locks; a lock is
+ * only taken when a thread records its first span. While tracing is off, a span costs
+ * one test of traceEnabled.
+ */
+
+// whether spans are recorded, see startTrace
+bool traceEnabled = false;
+
+typedef struct TraceEvent
+{
+    const char* name; // string literal
+    int64_t start;    // nanoseconds since startTrace
+    int64_t end;
+    int32_t x;        // tile or pixel coordinates, -1 if not applicable
+    int32_t y;
+    int64_t iterations; // iterations spent, -1 if not applicable
+} TraceEvent;
+
+// ring buffer of one thread; only the owning thread writes, older events are overwritten
+typedef struct TraceRing
+{
+    static const size_t capacity = 1 << 16;
+    std::vector<TraceEvent> events = std::vector<TraceEvent>(capacity);
+    std::atomic<uint64_t> count{0};
+    int id = 0;
+} TraceRing;
+
+typedef struct TraceRegistry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    // rings of threads that have ended, reused by new threads; the engine starts
+    // new worker threads for every parallelFor, so rings stand for worker lanes
+    std::vector<TraceRing*> unused;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+} TraceRegistry;
+
+TraceRegistry& traceRegistry()
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+// returns the ring of a thread to the registry when the thread ends
+typedef struct TraceThreadSlot
+{
+    TraceRing* ring = nullptr;
+
+    ~TraceThreadSlot()
+    {
+        if (ring) {
+            TraceRegistry& registry = traceRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.unused.push_back(ring);
+        }
+    }
+} TraceThreadSlot;
+
+thread_local TraceThreadSlot traceSlot;
+
+TraceRing* traceRing()
+{
+    if (!traceSlot.ring) {
+        TraceRegistry& registry = traceRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        if (!registry.unused.empty()) {
+            traceSlot.ring = registry.unused.back();
+            registry.unused.pop_back();
+        } else {
+            registry.rings.push_back(std::make_unique<TraceRing>());
+            registry.rings.back()->id = (int) registry.rings.size();
+            traceSlot.ring = registry.rings.back().get();
+        }
+    }
+    return traceSlot.ring;
+}
+
+int64_t traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceRegistry().origin).count();
+}
+
+/**
+ * @brief
+ * Records the time from construction to destruction as a span of the current thread,
+ * if tracing is enabled at construction.
+ */
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char* name, int x = -1, int y = -1)
+    {
+        if (traceEnabled) {
+            event.name = name;
+            event.x = x;
+            event.y = y;
+            event.iterations = -1;
+            event.start = traceNow();
+        } else {
+            event.name = nullptr;
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (!event.name) return;
+        event.end = traceNow();
+        TraceRing* ring = traceRing();
+        uint64_t n = ring->count.load(std::memory_order_relaxed);
+        ring->events[n % TraceRing::capacity] = event;
+        ring->count.store(n + 1, std::memory_order_release);
+    }
+
+    // whether the span is recorded, i.e. whether extra data for it is worth collecting
+    bool active() const { return event.name != nullptr; }
+
+    void setIterations(int64_t iterations) { event.iterations = iterations; }
+
+private:
+    TraceEvent event;
+};
+
+/**
+ * @brief
+ * Discard recorded spans and start recording.
+ */
+void startTrace()
+{
+    TraceRegistry& registry = traceRegistry();
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (auto& ring : registry.rings) {
+            ring->count.store(0, std::memory_order_relaxed);
+        }
+    }
+    registry.origin = std::chrono::steady_clock::now();
+    traceEnabled = true;
+}
+
+/**
+ * @brief
+ * Write the recorded spans in the Chrome trace event format (JSON). Each ring becomes a
+ * thread of the trace; of busy rings only the latest TraceRing::capacity spans are kept.
+ * Meant to be called while no spans are being recorded.
+ */
+bool writeTrace(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    TraceRegistry& registry = traceRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (auto& ring : registry.rings) {
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+            "\"args\": {\"name\": \"thread %d\"}}", first ? "" : ",\n", ring->id, ring->id);
+        first = false;
+        uint64_t count = ring->count.load(std::memory_order_acquire);
+        uint64_t begin = count > TraceRing::capacity ? count - TraceRing::capacity : 0;
+        for (uint64_t n = begin; n < count; ++n) {
+            const TraceEvent& event = ring->events[n % TraceRing::capacity];
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                "\"args\": {", event.name, ring->id, event.start / 1e3, (event.end - event.start) / 1e3);
+            const char* separator = "";
+            if (event.x >= 0) {
+                fprintf(file, "\"x\": %d, \"y\": %d", event.x, event.y);
+                separator = ", ";
+            }
+            if (event.iterations >= 0) {
+                fprintf(file, "%s\"iterations\": %lld", separator, (long long) event.iterations);
+            }
+            fprintf(file, "}}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
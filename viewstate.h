@@ -0,0 +1,416 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief
+ * Signed fixed-point number of arbitrary precision.
+ * The magnitude is stored in 32-bit limbs, most significant first: limbs[0] holds
+ * the integer part, every following limb adds 32 fractional bits.
+ * Results of arithmetic are truncated to the precision of the more precise operand.
+ */
+struct BigFixed
+{
+    bool negative = false;
+    std::vector<uint32_t> limbs;
+
+    explicit BigFixed(int fracLimbs = 2) : limbs(fracLimbs + 1, 0) {}
+
+    int fracLimbs() const { return (int) limbs.size() - 1; }
+    int fracBits() const { return 32 * fracLimbs(); }
+
+    bool isZero() const
+    {
+        return std::all_of(limbs.begin(), limbs.end(), [](uint32_t l) { return l == 0; });
+    }
+
+    /**
+     * @brief
+     * Extend (with zeros) or truncate the fractional part to <fracLimbs> limbs.
+     */
+    void setPrecision(int fracLimbs)
+    {
+        limbs.resize(fracLimbs + 1, 0);
+        if (isZero()) negative = false;
+    }
+
+    /**
+     * @brief
+     * Exact conversion of mantissa * 2^exponent. Bits below the precision are truncated.
+     */
+    static BigFixed fromDouble(double mantissa, int exponent, int fracLimbs)
+    {
+        BigFixed result(fracLimbs);
+        if (mantissa == 0.0 || !std::isfinite(mantissa)) return result;
+        result.negative = mantissa < 0;
+        int e;
+        double m = std::frexp(std::fabs(mantissa), &e);
+        uint64_t bits = (uint64_t) std::ldexp(m, 53);
+        // bit k of <bits> has the value 2^(k - 53 + e + exponent)
+        for (int k = 0; k < 53; ++k) {
+            if (!(bits >> k & 1)) continue;
+            long p = (long) k - 53 + e + exponent;
+            long q = p + 32L * fracLimbs; // position counted from the least significant bit
+            if (q < 0 || q >= 32L * (fracLimbs + 1)) continue;
+            result.limbs[fracLimbs - q / 32] |= 1u << (q % 32);
+        }
+        if (result.isZero()) result.negative = false;
+        return result;
+    }
+
+    static BigFixed fromDouble(double value, int fracLimbs = 2)
+    {
+        return fromDouble(value, 0, fracLimbs);
+    }
+
+    double toDouble() const
+    {
+        double value = 0.0;
+        for (int i = (int) limbs.size() - 1; i >= 0; --i) {
+            value += std::ldexp((double) limbs[i], -32 * i);
+        }
+        return negative ? -value : value;
+    }
+
+    /**
+     * @brief
+     * Compare magnitudes of two numbers with the same limb count.
+     * @return -1, 0 or 1
+     */
+    static int compareMagnitude(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+    {
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    friend BigFixed operator+(BigFixed a, BigFixed b)
+    {
+        int n = std::max(a.fracLimbs(), b.fracLimbs());
+        a.setPrecision(n);
+        b.setPrecision(n);
+        if (a.negative == b.negative) {
+            uint64_t carry = 0;
+            for (int i = n; i >= 0; --i) {
+                uint64_t sum = (uint64_t) a.limbs[i] + b.limbs[i] + carry;
+                a.limbs[i] = (uint32_t) sum;
+                carry = sum >> 32;
+            }
+            return a;
+        }
+        // different signs: subtract the smaller magnitude from the larger one
+        if (compareMagnitude(a.limbs, b.limbs) < 0) std::swap(a, b);
+        int64_t borrow = 0;
+        for (int i = n; i >= 0; --i) {
+            int64_t diff = (int64_t) a.limbs[i] - b.limbs[i] - borrow;
+            borrow = diff < 0;
+            a.limbs[i] = (uint32_t) (diff + (borrow << 32));
+        }
+        if (a.isZero()) a.negative = false;
+        return a;
+    }
+
+    BigFixed operator-() const
+    {
+        BigFixed result = *this;
+        if (!result.isZero()) result.negative = !result.negative;
+        return result;
+    }
+
+    friend BigFixed operator-(const BigFixed& a, const BigFixed& b) { return a + (-b); }
+
+    friend BigFixed operator*(const BigFixed& a, const BigFixed& b)
+    {
+        int na = (int) a.limbs.size();
+        int nb = (int) b.limbs.size();
+        int n = std::max(a.fracLimbs(), b.fracLimbs());
+        // full product, least significant limb first
+        std::vector<uint64_t> product(na + nb, 0);
+        for (int i = 0; i < na; ++i) {
+            uint64_t carry = 0;
+            uint64_t ai = a.limbs[na - 1 - i];
+            if (ai == 0) continue;
+            for (int j = 0; j < nb; ++j) {
+                uint64_t t = ai * b.limbs[nb - 1 - j] + product[i + j] + carry;
+                product[i + j] = (uint32_t) t;
+                carry = t >> 32;
+            }
+            product[i + nb] += carry;
+        }
+        // the product has (na - 1) + (nb - 1) fractional limbs, keep n of them
+        int drop = (na - 1) + (nb - 1) - n;
+        BigFixed result(n);
+        for (int i = 0; i <= n; ++i) {
+            result.limbs[n - i] = (uint32_t) product[drop + i];
+        }
+        result.negative = (a.negative != b.negative) && !result.isZero();
+        return result;
+    }
+
+    BigFixed& operator+=(const BigFixed& other) { return *this = *this + other; }
+    BigFixed& operator-=(const BigFixed& other) { return *this = *this - other; }
+
+    /**
+     * @brief
+     * Multiply the magnitude by a small factor and add <addend> to the lowest limb.
+     * @return overflow out of the integer limb
+     */
+    uint32_t mulSmall(uint32_t factor, uint32_t addend = 0)
+    {
+        uint64_t carry = addend;
+        for (int i = (int) limbs.size() - 1; i >= 0; --i) {
+            uint64_t t = (uint64_t) limbs[i] * factor + carry;
+            limbs[i] = (uint32_t) t;
+            carry = t >> 32;
+        }
+        return (uint32_t) carry;
+    }
+
+    /**
+     * @brief
+     * Divide the magnitude by a small divisor.
+     * @return remainder
+     */
+    uint32_t divSmall(uint32_t divisor)
+    {
+        uint64_t remainder = 0;
+        for (size_t i = 0; i < limbs.size(); ++i) {
+            uint64_t t = (remainder << 32) | limbs[i];
+            limbs[i] = (uint32_t) (t / divisor);
+            remainder = t % divisor;
+        }
+        return (uint32_t) remainder;
+    }
+
+    /**
+     * @brief
+     * Shortest decimal representation that reads back (with fromString) to the
+     * identical value at the same precision.
+     */
+    std::string toString() const
+    {
+        uint64_t integer = limbs[0];
+        // fraction and half an ulp, both with one guard limb
+        BigFixed fraction = *this;
+        fraction.setPrecision(fracLimbs() + 1);
+        fraction.limbs[0] = 0;
+        BigFixed halfUlp(fracLimbs() + 1);
+        halfUlp.limbs.back() = 0x80000000u;
+
+        std::string frac;
+        while (!fraction.isZero()) {
+            fraction.mulSmall(10);
+            halfUlp.mulSmall(10);
+            frac += (char) ('0' + fraction.limbs[0]);
+            fraction.limbs[0] = 0;
+            if (compareMagnitude(fraction.limbs, halfUlp.limbs) <= 0) break;
+            BigFixed rest(fracLimbs() + 1);
+            rest.limbs[0] = 1;
+            rest = rest - fraction;
+            if (compareMagnitude(rest.limbs, halfUlp.limbs) <= 0) {
+                // closer to the next decimal: round the last digit up
+                int i = (int) frac.size() - 1;
+                for (; i >= 0 && frac[i] == '9'; --i) frac[i] = '0';
+                if (i >= 0) ++frac[i];
+                else ++integer;
+                break;
+            }
+        }
+        frac.erase(frac.find_last_not_of('0') + 1);
+        std::string s = negative ? "-" : "";
+        s += std::to_string(integer);
+        return frac.empty() ? s : s + "." + frac;
+    }
+
+    /**
+     * @brief
+     * Parse a decimal number such as "-1.21235", "5e-3" or "0.31898900000000000012",
+     * rounding to the nearest value with <fracLimbs> fractional limbs.
+     *
+     * @return false if <text> is not a number
+     */
+    static bool fromString(const std::string& text, int fracLimbs, BigFixed& out)
+    {
+        size_t pos = 0;
+        bool negative = false;
+        if (pos < text.size() && (text[pos] == '-' || text[pos] == '+')) {
+            negative = text[pos++] == '-';
+        }
+        std::string digits;
+        long pointPosition = -1;
+        for (; pos < text.size(); ++pos) {
+            char ch = text[pos];
+            if (ch >= '0' && ch <= '9') {
+                digits += ch;
+            } else if (ch == '.' && pointPosition < 0) {
+                pointPosition = (long) digits.size();
+            } else {
+                break;
+            }
+        }
+        if (digits.empty()) return false;
+        if (pointPosition < 0) pointPosition = (long) digits.size();
+        if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+            char* end;
+            long exponent = std::strtol(text.c_str() + pos + 1, &end, 10);
+            if (end == text.c_str() + pos + 1) return false;
+            pos = end - text.c_str();
+            pointPosition += exponent;
+        }
+        if (pos != text.size()) return false;
+
+        // move the decimal point so that 0 <= pointPosition <= digits.size()
+        if (pointPosition < 0) {
+            digits.insert(0, -pointPosition, '0');
+            pointPosition = 0;
+        } else if (pointPosition > (long) digits.size()) {
+            digits.append(pointPosition - digits.size(), '0');
+        }
+
+        // one guard limb, then round to nearest
+        BigFixed value(fracLimbs + 1);
+        for (long i = (long) digits.size() - 1; i >= pointPosition; --i) {
+            value.limbs[0] = digits[i] - '0';
+            value.divSmall(10);
+        }
+        uint64_t integer = 0;
+        for (long i = 0; i < pointPosition; ++i) {
+            integer = integer * 10 + (digits[i] - '0');
+            if (integer > UINT32_MAX) return false;
+        }
+        value.limbs[0] = (uint32_t) integer;
+        bool roundUp = value.limbs.back() >= 0x80000000u;
+        value.setPrecision(fracLimbs);
+        if (roundUp) {
+            BigFixed ulp(fracLimbs);
+            ulp.limbs.back() = 1;
+            value = value + ulp;
+        }
+        value.negative = negative && !value.isZero();
+        out = value;
+        return true;
+    }
+};
+
+/**
+ * @brief
+ * Position and magnification of the explorer window.
+ * The center is kept at arbitrary precision, the zoom as log2 of the zoom factor,
+ * so that panning and zooming never lose bits and a view can be written out and
+ * rendered again exactly.
+ * The meaning of zoom factor 1 (visible range in the complex plane) is up to the
+ * program using the view.
+ */
+struct ViewState
+{
+    BigFixed real;
+    BigFixed imaginary;
+    double logZoom = 0.0;
+
+    double zoomFactor() const { return std::exp2(logZoom); }
+
+    /**
+     * @brief
+     * Number of fractional limbs needed to resolve single pixels at the current zoom,
+     * with a generous margin for image widths and accumulated pans.
+     */
+    int precisionLimbs() const
+    {
+        int bits = (int) std::ceil(std::max(0.0, logZoom)) + 64;
+        return std::max(2, (bits + 31) / 32);
+    }
+
+    void updatePrecision()
+    {
+        int limbs = precisionLimbs();
+        if (limbs > real.fracLimbs()) real.setPrecision(limbs);
+        if (limbs > imaginary.fracLimbs()) imaginary.setPrecision(limbs);
+    }
+
+    /**
+     * @brief
+     * Move the center by (dx, dy) / zoom factor, i.e. dx and dy are given in
+     * units of the unzoomed view. The step is converted exactly, also for zoom
+     * factors beyond the range of a double.
+     */
+    void pan(double dx, double dy)
+    {
+        updatePrecision();
+        double integerPart = std::floor(logZoom);
+        double scale = std::exp2(integerPart - logZoom);
+        int exponent = (int) -integerPart;
+        real += BigFixed::fromDouble(dx * scale, exponent, real.fracLimbs());
+        imaginary += BigFixed::fromDouble(dy * scale, exponent, imaginary.fracLimbs());
+    }
+
+    /**
+     * @brief
+     * Multiply the zoom factor by <factor> (> 1 zooms in).
+     */
+    void zoom(double factor)
+    {
+        logZoom += std::log2(factor);
+        updatePrecision();
+    }
+
+    /**
+     * @brief
+     * "<real> <imaginary> 2^<log2 zoom>", readable by fromString.
+     */
+    std::string toString() const
+    {
+        char zoomText[64];
+        snprintf(zoomText, sizeof(zoomText), "2^%.17g", logZoom);
+        return real.toString() + " " + imaginary.toString() + " " + zoomText;
+    }
+
+    /**
+     * @brief
+     * Parse "<real> <imaginary> <zoom>". The zoom may be given as a plain factor
+     * ("70430.5"), as a reciprocal ("1/1.41981e-05") or as a power of two ("2^16.1").
+     *
+     * @return false if <text> is malformed
+     */
+    static bool fromString(const std::string& text, ViewState& out)
+    {
+        std::istringstream stream(text);
+        std::string re, im, zoom;
+        if (!(stream >> re >> im >> zoom)) return false;
+        std::string rest;
+        if (stream >> rest) return false;
+
+        ViewState view;
+        char* end;
+        if (zoom.rfind("2^", 0) == 0) {
+            view.logZoom = std::strtod(zoom.c_str() + 2, &end);
+        } else if (zoom.rfind("1/", 0) == 0) {
+            view.logZoom = -std::log2(std::strtod(zoom.c_str() + 2, &end));
+        } else {
+            view.logZoom = std::log2(std::strtod(zoom.c_str(), &end));
+        }
+        if (*end != '\0' || !std::isfinite(view.logZoom)) return false;
+
+        int limbs = view.precisionLimbs();
+        if (!BigFixed::fromString(re, limbs, view.real)) return false;
+        if (!BigFixed::fromString(im, limbs, view.imaginary)) return false;
+        out = view;
+        return true;
+    }
+
+    static ViewState fromDoubles(double real, double imaginary, double zoomFactor)
+    {
+        ViewState view;
+        view.logZoom = std::log2(zoomFactor);
+        view.real = BigFixed::fromDouble(real, view.precisionLimbs());
+        view.imaginary = BigFixed::fromDouble(imaginary, view.precisionLimbs());
+        return view;
+    }
+};